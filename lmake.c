@@ -12,6 +12,10 @@
  *   Makefile       # a Makefile with the following targets:
  *     make library # builds Dictu as a shared library 
  *     make interpr # builds an interpreter    
+ *     make bench   # runs the src/bench workloads against the interpreter, and
+ *                  # writes the median times to bench-$(NAME).json
+ *     make interpr-pgo # builds the library and the interpreter twice (gcc), and
+ *                  # optimizes the second build with the profile of a bench run
  *
  * Usage:
  *  make clone-upstream   # clones the dictu sources (requires git)
@@ -35,11 +39,28 @@
  *                          # run without any modification, otherwise is a bug
  *      --disable-exit      # disables exit() method from System Class
  *                          # off by default, enabled with lai implicitly
+ *      --lazy-natives      # declare the datatype methods on their first use,
+ *                          # instead of at vm initialization
+ *      --gc-mark-bitmap    # keep the marks of the collector outside of the objects
+ *      --gc-grow-factor=`n'
+ *                          # the heap grows by n after a collection, default [2]
+ *      --gc-min-heap=`mb'  # no collection runs below mb megabytes, default [1]
+ *      --enable-profiler   # build a sampling profiler into the library, that the
+ *                          # interpreter enables with --profile=`file'
+ *      --enable-opstats    # build a library that counts the executed opcodes and
+ *                          # opcode pairs, and reports them when a vm is freed
+ *      --enable-pgo        # with --build-interp, build a profile guided library and
+ *                          # interpreter, trained on the src/bench workloads (gcc)
+ *      --fuse=`op,op[,..]' # fuse an opcode sequence, like GET_LOCAL,GET_LOCAL,ADD,
+ *                          # into a superinstruction (can be given many times)
+ *      --fuse-file=`file'  # fuse the sequences of file, one per line, as the pairs
+ *                          # of the --enable-opstats report
  *      --parse-lai         # parse lai script and output a Dictu script with a .du extension
  *                          # Note: When this option is encountered, parsing argv stops
  *                          # and any subsequent argunent is treated as argument to this
  *                          # function, which after its execution the program exits
- *                          # Also note that this is a crude algorithm
+ *                          # The words are translated as the lai scanner reads them, but
+ *                          # in strings and comments
  *      --sysdir=`dir'      # system directory with write access, default [../sys]
  *      --builddir=`dir'    # build directory, default [build/dictu] or [build/lai]
  *      --langcdir=`dir'    # Dictu c sources directory, default [src/Dictu]
@@ -52,6 +73,7 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -60,6 +82,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <math.h>
 
 #define ifnot(__expr__) if (0 == (__expr__))
 #define bytelen strlen
@@ -126,6 +149,19 @@ char *opt_files[] = {
   "system"
 };
 
+/* sources from srcdir that are appended to the generated vm.c extensions */
+char *ext_files[] = {
+  "ext_strings.c",
+  "ext_bulk.c",
+  "ext_arena.c",
+  "ext_reset.c",
+  "ext_stats.c",
+  "ext_profiler.c",
+  "ext_opstats.c",
+  "ext_trace.c",
+  "ext_safepoint.c",
+};
+
 char *feature_macros = "#define _XOPEN_SOURCE 700\n\n";
 
 char *std_headers[] = {
@@ -139,11 +175,14 @@ char *std_headers[] = {
   "unistd",
   "ctype",
   "time",
+  "signal",
   "math",
   "sys/utsname",
   "sys/stat",
+  "sys/time",
   "sys/types",
   "sys/wait",
+  "fcntl",
   "curl/curl",
   "sqlite3",
   "dirent",
@@ -153,6 +192,7 @@ char *std_headers[] = {
 };
 
 char main_headers[] =
+  "#define _XOPEN_SOURCE 700\n\n"
   "#include <stdint.h>\n"
   "#include <stddef.h>\n"
   "#include <stdbool.h>\n"
@@ -179,9 +219,17 @@ char main_headers[] =
 #define DICTU_API  "dictu.h"
 #define LAI_API    "lai.h"
 #define LAI_EXTRA  "lai_identifierType.c"
+#define VM_TYPES   "vm_types.h"
+#define VM_FIELDS  "vm_fields.h"
+#define VM_PROTOS  "vm_protos.h"
+#define REALLOCATE "reallocate.c"
+#define MEMORY_EXT "ext_memory.c"
+#define MARKS_EXT  "ext_marks.c"
+#define OPTIMIZE_EXT "ext_optimize.c"
 
 #define MAKE_LIBRARY "make library"
 #define MAKE_INTERP "make interp"
+#define MAKE_INTERP_PGO "make interpr-pgo"
 #define MAKE_CLEAN "make clean"
 
 #define DIR_SEP           '/'
@@ -200,6 +248,46 @@ char main_headers[] =
 
 typedef struct lang_t lang_t;
 
+#define MAX_NATIVE_TABLES 32
+#define MAX_OBJ_TYPES     32
+#define MAX_FUSED         32
+#define MAX_FUSED_LEN     4
+#define MAX_OPCODES       256
+
+typedef struct native_table_t {
+  char target[64];
+  int count;
+  int reserved;
+} native_table_t;
+
+typedef struct native_t {
+  char
+    *target,
+    *name,
+    *function;
+
+  size_t
+    target_len,
+    name_len,
+    function_len;
+
+  int indent;
+} native_t;
+
+/* a superinstruction, the opcodes it runs and the OP_ name it gets */
+typedef struct fused_t {
+  char ops[MAX_FUSED_LEN][32];
+  char name[MAX_FUSED_LEN * 33];
+  int len;
+} fused_t;
+
+/* the text of a CASE_CODE() of run(), after the colon */
+typedef struct case_body_t {
+  char name[32];
+  char *body;
+  size_t len;
+} case_body_t;
+
 typedef int(*File_cb) (lang_t *, char *);
 typedef int(*Line_cb) (lang_t *, char *, char *, size_t);
 
@@ -223,7 +311,14 @@ typedef struct lang_t {
     enable_http,
     enable_sqlite,
     enable_repl,
+    enable_profiler,
+    enable_opstats,
+    enable_pgo,
     disable_exit,
+    lazy_natives,
+    gc_mark_bitmap,
+    gc_min_heap,
+    num_lazy_methods,
     build_library,
     build_interp,
     donot_generate,
@@ -231,8 +326,32 @@ typedef struct lang_t {
     clean_build,
     help,
     skip_function,
+    in_string_struct,
+    in_vm_struct,
+    in_init_vm,
+    in_safepoint_case,
+    in_run_loop,
+    in_end_compiler,
+    opcode_hooks,
+    skip_reallocate,
     lai_to_dictu,
-    make_sys_dir;
+    make_sys_dir,
+    num_native_tables;
+
+  native_table_t native_tables[MAX_NATIVE_TABLES];
+  char lazy_methods[MAX_NATIVE_TABLES][32];
+  char obj_types[MAX_OBJ_TYPES][32];
+  int num_obj_types;
+  char opcodes[MAX_OPCODES][32];
+  int num_opcodes;
+  int has_nops;
+  fused_t fused[MAX_FUSED];
+  int num_fused;
+  case_body_t case_bodies[MAX_FUSED * MAX_FUSED_LEN];
+  int num_case_bodies;
+  case_body_t *case_body;
+
+  double gc_grow_factor;
 
   FILE *fp_out;
 
@@ -393,7 +512,7 @@ char **dirlist (char *dir) {
     files = Realloc (files, num_files * sizeof (char *));
   }
 
-  files[num_files - 1] = NULL;
+  files[idx] = NULL;
 
   closedir (dh);
   return files;
@@ -581,7 +700,180 @@ char *insert_str (lang_t *this, char *line, size_t len, char *ptr, char *buf, si
   return line;
 }
 
+uint32_t hash_string (const char *key, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint32_t) (unsigned char) key[i];
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+/* matches: <indent>defineNative(vm, <target>, "<name>", <function>);\n */
+int parse_native_line (char *line, native_t *native) {
+  char *sp = line;
+  while (*sp == ' ' || *sp == '\t') sp++;
+
+  native->indent = sp - line;
+  if (0 == str_eq_n (sp, "defineNative(vm, &", 18))
+    return 0;
+
+  native->target = sp + 17;
+  if (NULL == (sp = strstr (native->target, ", \"")))
+    return 0;
+
+  native->target_len = sp - native->target;
+  native->name = sp + 3;
+
+  /* escapes and non ascii names are hashed at runtime */
+  for (sp = native->name; *sp != '"'; sp++)
+    if (*sp == '\\' || *sp == '\0' || (uchar) *sp > 127)
+      return 0;
+
+  native->name_len = sp - native->name;
+  if (0 == str_eq_n (sp, "\", ", 3))
+    return 0;
+
+  native->function = sp + 3;
+  if (NULL == (sp = strstr (native->function, ");\n")) || sp[3] != '\0')
+    return 0;
+
+  native->function_len = sp - native->function;
+  return 1;
+}
+
+/* counts the natives per vm table, so the table can be sized up front */
+int count_natives (lang_t *this, char *file) {
+  this->num_native_tables = 0;
+
+  FILE *fp = fopen (file, "r");
+  if (NULL == fp)
+    return 0;
+
+  char *line = NULL;
+  size_t len = 0;
+  native_t native;
+
+  while (-1 != getline (&line, &len, fp)) {
+    if (0 == parse_native_line (line, &native))
+      continue;
+
+    if (0 == str_eq_n (native.target, "&vm->", 5))
+      continue;
+
+    int idx = 0;
+    for (; idx < this->num_native_tables; idx++)
+      if (native.target_len == bytelen (this->native_tables[idx].target) &&
+          str_eq_n (this->native_tables[idx].target, native.target, native.target_len))
+        break;
+
+    if (idx == this->num_native_tables) {
+      if (idx == MAX_NATIVE_TABLES || native.target_len >= sizeof (this->native_tables[idx].target))
+        continue;
+
+      str_cp (this->native_tables[idx].target, sizeof (this->native_tables[idx].target),
+          native.target, native.target_len);
+      this->native_tables[idx].count = 0;
+      this->native_tables[idx].reserved = 0;
+      this->num_native_tables++;
+    }
+
+    this->native_tables[idx].count++;
+
+    /* parse_system() adds gcStats beside collect */
+    if (strstr (file, "system.c") &&
+        native.name_len == 7 && str_eq_n (native.name, "collect", 7))
+      this->native_tables[idx].count++;
+  }
+
+  free (line);
+  fclose (fp);
+  return 0;
+}
+
+int parse_define_native (lang_t *this, char *file, char *line, size_t len) {
+  (void) len;
+  native_t native;
+  if (0 == parse_native_line (line, &native))
+    return PARSELINE_OK;
+
+  /* parse_system() comments it out */
+  if (this->disable_exit && strstr (file, "system.c") &&
+      native.name_len == 4 && str_eq_n (native.name, "exit", 4))
+    return PARSELINE_OK;
+
+  for (int i = 0; i < this->num_native_tables; i++) {
+    native_table_t *table = &this->native_tables[i];
+    if (table->reserved || native.target_len != bytelen (table->target) ||
+        0 == str_eq_n (table->target, native.target, native.target_len))
+      continue;
+
+    fprintf (this->fp_out, "%*svm_table_reserve(vm, %s, %d);\n",
+        native.indent, "", table->target, table->count);
+    table->reserved = 1;
+  }
+
+  fprintf (this->fp_out, "%*sdefineNativeHashed(vm, %.*s, \"%.*s\", %d, %uu, %.*s);\n",
+      native.indent, "",
+      (int) native.target_len, native.target,
+      (int) native.name_len, native.name,
+      (int) native.name_len, hash_string (native.name, native.name_len),
+      (int) native.function_len, native.function);
+
+  return PARSELINE_NEXT_LINE;
+}
+
+int write_src_file (lang_t *this, const char *name) {
+  size_t name_len = bytelen (name);
+  char file[this->src_dir_len + name_len + 2];
+  snprintf (file, this->src_dir_len + name_len + 2, "%s/%s",
+      this->src_dir, name);
+
+  FILE *fp = fopen (file, "r");
+  if (fp == NULL) {
+    fprintf (stderr, "fopen(): %s\n%s\n", file, strerror (errno));
+    return -1;
+  }
+
+  if (-1 == fseek (fp, 0, SEEK_END)) {
+    fprintf (stderr, "fseek(): %s\n", strerror (errno));
+    fclose (fp);
+    return -1;
+  }
+
+  long bytes = ftell (fp);
+  if (-1 == bytes) {
+    fprintf (stderr, "ftell(): %s\n", strerror (errno));
+    fclose (fp);
+    return -1;
+  }
+
+  if (-1 == fseek (fp, 0, SEEK_SET)) {
+    fprintf (stderr, "fseek(): %s\n", strerror (errno));
+    fclose (fp);
+    return -1;
+  }
+
+  char *buf = Alloc (bytes + 1);
+  if ((size_t) bytes != fread (buf, 1, bytes, fp)) {
+    fprintf (stderr, "fread(): couldn't read the requester bytes\n");
+    free (buf);
+    fclose (fp);
+    return -1;
+  }
+
+  buf[bytes] = '\0';
+  fprintf (this->fp_out, "%s", buf);
+  free (buf);
+  fclose (fp);
+  return 0;
+}
+
 int file_cb (lang_t *this, char * file) {
+  if (this->exttype == C_TYPE)
+    count_natives (this, file);
+
   if (NULL != strstr (file, "hashlib/constants.c"))
     return PARSEFILE_NEXT;
 
@@ -620,6 +912,25 @@ int parse_compiler (lang_t *this, char *line, size_t len) {
   (void) this;
   if (len < 5) return PARSELINE_OK;
 
+  /* the optimizer, and the superinstructions, run on each function */
+  if (str_eq_n (line, "static ObjFunction *endCompiler(", 32)) {
+    fprintf (this->fp_out, "void optimizeChunk(DictuVM *vm, Chunk *chunk);\n%s\n%s",
+        this->num_fused ? "static void fuseChunk(Chunk *chunk);\n" : "", line);
+    this->in_end_compiler = 1;
+    return PARSELINE_NEXT_LINE;
+  }
+
+  char *ret = strstr (line, "emitReturn(compiler);");
+  if (this->in_end_compiler && ret) {
+    fprintf (this->fp_out, "%s%.*soptimizeChunk(compiler->parser->vm, &compiler->function->chunk);\n",
+        line, (int) (ret - line), line);
+    if (this->num_fused)
+      fprintf (this->fp_out, "%.*sfuseChunk(&compiler->function->chunk);\n", (int) (ret - line), line);
+    this->in_end_compiler = 0;
+    this->opcode_hooks |= 1;
+    return PARSELINE_NEXT_LINE;
+  }
+
   char prefix[] = "comp_";
   size_t pr_len = 5;
 
@@ -698,46 +1009,10 @@ int parse_scanner (lang_t *this, char *line, size_t len) {
     }
 
     if (str_eq_n (line, "static TokenType identifierType", 31)) {
-      char ext[this->src_dir_len + this->lai_ext_len + 2];
-      snprintf (ext, this->src_dir_len + this->lai_ext_len + 2, "%s/%s",
-          this->src_dir, LAI_EXTRA);
-
-      FILE *fp = fopen (ext, "r");
-      if (fp == NULL) {
-        fprintf (stderr, "fopen(): %s\n%s\n", ext, strerror (errno));
-        return PARSELINE_BREAK;
-      }
-
-      if (-1 == fseek (fp, 0, SEEK_END)) {
-        fprintf (stderr, "fseek(): %s\n", strerror (errno));
-        fclose (fp);
-        return PARSELINE_BREAK;
-      }
-
-      long bytes = ftell (fp);
-      if (-1 == bytes) {
-        fprintf (stderr, "ftell(): %s\n", strerror (errno));
-        fclose (fp);
-        return PARSELINE_BREAK;
-      }
-
-      if (-1 == fseek (fp, 0, SEEK_SET)) {
-        fprintf (stderr, "fseek(): %s\n", strerror (errno));
-        fclose (fp);
+      if (-1 == write_src_file (this, LAI_EXTRA))
         return PARSELINE_BREAK;
-      }
-
-      char buf[bytes + 1];
-      if ((size_t) bytes != fread (buf, 1, bytes, fp)) {
-        fprintf (stderr, "fread(): couldn't read the requester bytes\n");
-        fclose (fp);
-        return PARSELINE_BREAK;
-      }
 
-      buf[bytes] = '\0';
-      fprintf (this->fp_out, "%s", buf);
       this->skip_function = 1;
-      fclose (fp);
       return PARSELINE_NEXT_LINE;
     }
   }
@@ -755,151 +1030,1209 @@ int parse_class (lang_t *this, char *line, size_t len) {
     return PARSELINE_OK;
   }
 
-  tmp = strstr (line, "toString)");
-  if (tmp)
-    line = insert_str (this, line, len, tmp, prefix, pr_len);
+  tmp = strstr (line, "toString)");
+  if (tmp)
+    line = insert_str (this, line, len, tmp, prefix, pr_len);
+
+  return PARSELINE_OK;
+}
+
+int parse_env (lang_t *this, char *line, size_t len) {
+  char prefix[] = "env_";
+  size_t pr_len = 4;
+  char *tmp = strstr (line, "get(");
+  if (tmp) {
+    line = insert_str (this, line, len, tmp, prefix, pr_len);
+    return PARSELINE_OK;
+  }
+
+  tmp = strstr (line, "get)");
+  if (tmp)
+    line = insert_str (this, line, len, tmp, prefix, pr_len);
+
+  return PARSELINE_OK;
+}
+
+int parse_system (lang_t *this, char *line, size_t len) {
+  /* gcStats goes after collect, so it is defined (and hashed) after the
+   * table reserve that count_natives() sized with it */
+  char *collect = strstr (line, "defineNative(vm, &klass->methods, \"collect\", collectNative);");
+  if (collect) {
+    char gc_stats[128];
+    snprintf (gc_stats, sizeof (gc_stats),
+        "%.*sdefineNative(vm, &klass->methods, \"gcStats\", vm_gc_stats_native);\n",
+        (int) (collect - line), line);
+
+    int hashed = this->exttype == C_TYPE && this->base_dir != this->lang_c_dir;
+    if (0 == hashed || PARSELINE_OK == parse_define_native (this, "system.c", line, len))
+      fprintf (this->fp_out, "%s", line);
+
+    if (0 == hashed || PARSELINE_OK == parse_define_native (this, "system.c", gc_stats, bytelen (gc_stats)))
+      fprintf (this->fp_out, "%s", gc_stats);
+
+    return PARSELINE_NEXT_LINE;
+  }
+
+  /* exitNative() exits through vm_exit(), that lets the host see the status */
+  char *sp = line;
+  while (*sp == ' ') sp++;
+  if (str_eq_n (sp, "exit(", 5)) {
+    fprintf (this->fp_out, "%.*svm_exit(vm, %s", (int) (sp - line), line, sp + 5);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  char pat[] = "defineNative(vm, &klass->methods, \"exit\", exitNative);\n";
+  size_t plen = bytelen (pat);
+
+  if (len < plen)
+    return PARSELINE_OK;
+
+  ifnot (this->disable_exit)
+    return PARSELINE_OK;
+
+
+  char dis_txt[] = "/*** DISABLED ***/\n    (void) exitNative;\n    // ";
+  size_t dis_len = bytelen (dis_txt);
+
+  char *tmp = strstr (line, pat);
+  if (tmp)
+    line = insert_str (this, line, len, tmp, dis_txt, dis_len);
+
+  return PARSELINE_OK;
+}
+
+int parse_jsonBuilderLib (lang_t *this, char *line, size_t len) {
+  (void) this; (void) len;
+  char *tmp = strstr (line, "default_opts");
+  if (tmp) {
+    tmp[0] = 'D';
+    tmp[8] = 'O';
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_jsonParseLib (lang_t *this, char *line, size_t len) {
+  char *tmp = strstr (line, "uchar");
+  while (tmp) {
+    if (*(tmp-1) != '_' || *(tmp+5) != '2') {
+      line = insert_str (this, line, len, tmp, "l_", 2);
+      len += 2;
+    }
+
+    tmp = strstr (tmp + 5, "uchar");
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_sqlite (lang_t *this, char *line, size_t len) {
+  char prefix[] = "sqlite_";
+  size_t pr_len = 7;
+
+  char *tmp = strstr (line, "execute");
+  while (tmp) {
+    line = insert_str (this, line, len, tmp, prefix, pr_len);
+    len += pr_len;
+    tmp = strstr(tmp + 14, "execute");
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_optionals (lang_t *this, char *line, size_t len) {
+  if (strstr (line, "Sqlite")) {
+    line = insert_str (this, line, len, line,
+        "#ifndef DISABLE_SQLITE\n", 23);
+
+    char *ptr = line + len + 23;
+    line = insert_str (this, line, len + 23, ptr,
+     "#endif /* DISABLE_SQLITE */\n", 28);
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_datetime (lang_t *this, char *line, size_t len) {
+  (void) this; (void) len; (void) len;
+  return PARSELINE_OK;
+
+  char *tmp = strstr (line, "XOPEN");
+  if (tmp)
+    return PARSELINE_NEXT_LINE;
+
+  return PARSELINE_OK;
+}
+
+int parse_object_h (lang_t *this, char *line, size_t len) {
+  (void) len;
+  if (str_eq (line, "struct sObjString {\n")) {
+    this->in_string_struct = 1;
+    fprintf (this->fp_out,
+        "typedef void (*ObjStringRelease)(void *data, char *chars, int length);\n\n");
+    return PARSELINE_OK;
+  }
+
+  if (this->in_string_struct && str_eq (line, "};\n")) {
+    this->in_string_struct = 0;
+    fprintf (this->fp_out,
+        "    ObjStringRelease release;\n"
+        "    void *releaseData;\n");
+    return PARSELINE_OK;
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_object (lang_t *this, char *line, size_t len) {
+  (void) len;
+  char *tmp = strstr (line, "object->type = type;");
+  if (tmp) {
+    int indent = (int) (tmp - line);
+    fprintf (this->fp_out, "%s%.*svm->gcObjects[type]++;\n"
+        "%.*sif (type == OBJ_ABSTRACT)\n"
+        "%.*s    vm->finalizers++;\n",
+        line, indent, line, indent, line, indent, line);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  tmp = strstr (line, "string->hash = hash;");
+  if (NULL == tmp)
+    return PARSELINE_OK;
+
+  fprintf (this->fp_out, "%s", line);
+  fprintf (this->fp_out, "%.*sstring->release = NULL;\n", (int) (tmp - line), line);
+  fprintf (this->fp_out, "%.*sstring->releaseData = NULL;\n", (int) (tmp - line), line);
+  return PARSELINE_NEXT_LINE;
+}
+
+/* the ObjType enumerators of object.h, in order, without the OBJ_ prefix
+ * and lower cased, name the per type counters of vm_gc_stats() */
+int read_obj_types (lang_t *this) {
+  this->num_obj_types = 0;
+
+  char file[this->lang_c_dir_len + 16];
+  snprintf (file, sizeof (file), "%s/vm/object.h", this->lang_c_dir);
+
+  FILE *fp = fopen (file, "r");
+  if (NULL == fp) {
+    fprintf (stderr, "fopen(): %s\n%s\n", file, strerror (errno));
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t len = 0;
+  int in_enum = 0;
+
+  while (-1 != getline (&line, &len, fp)) {
+    if (str_eq (line, "typedef enum {\n")) {
+      in_enum = 1;
+      this->num_obj_types = 0;
+      continue;
+    }
+
+    if (0 == in_enum)
+      continue;
+
+    char *sp = line;
+    while (*sp == ' ') sp++;
+
+    if (*sp == '}') {
+      if (str_eq (sp, "} ObjType;\n"))
+        break;
+      in_enum = 0;
+      continue;
+    }
+
+    if (0 == str_eq_n (sp, "OBJ_", 4) || this->num_obj_types == MAX_OBJ_TYPES)
+      continue;
+
+    char *name = this->obj_types[this->num_obj_types++];
+    int i = 0;
+    for (sp += 4; i < 31 && (*sp == '_' || (*sp >= 'A' && *sp <= 'Z') ||
+        (*sp >= '0' && *sp <= '9')); sp++)
+      name[i++] = (*sp >= 'A' && *sp <= 'Z') ? *sp + ('a' - 'A') : *sp;
+    name[i] = '\0';
+  }
+
+  free (line);
+  fclose (fp);
+  return 0;
+}
+
+int write_gc_stats (lang_t *this) {
+  if (-1 == read_obj_types (this))
+    return -1;
+
+  fprintf (this->fp_out, "static const char *ObjTypeNames[] = {");
+  for (int i = 0; i < this->num_obj_types; i++)
+    fprintf (this->fp_out, "%s\"%s\"", i ? ", " : "", this->obj_types[i]);
+
+  fprintf (this->fp_out, "%sNULL};\n\n"
+      "const char *vm_gc_obj_type_name(int type) {\n"
+      "    if (type < 0 || type >= %d)\n"
+      "        return NULL;\n"
+      "    return ObjTypeNames[type];\n}\n\n"
+      "void vm_gc_stats(DictuVM *vm, DictuGCStats *stats) {\n"
+      "    memset(stats, 0, sizeof(DictuGCStats));\n"
+      "    stats->bytesAllocated = vm->gcBytesAllocated;\n"
+      "    stats->bytesFreed = vm->gcBytesFreed;\n"
+      "    stats->liveBytes = vm->bytesAllocated;\n"
+      "    stats->collections = vm->gcPauses.collections;\n"
+      "    stats->totalPauseNs = vm->gcPauses.totalNs;\n"
+      "    stats->maxPauseNs = vm->gcPauses.maxNs;\n"
+      "    memcpy(stats->objects, vm->gcObjects, sizeof(vm->gcObjects));\n}\n\n",
+      this->num_obj_types ? ", " : "", this->num_obj_types);
+
+  return 0;
+}
+
+/* superinstructions: --fuse=GET_LOCAL,GET_LOCAL,ADD (or a --fuse-file= with
+ * such sequences one per line, like the pairs of an --enable-opstats report)
+ * gets an OPCODE(GET_LOCAL__GET_LOCAL__ADD) appended to opcodes.h, a case in
+ * run() that runs the cases of the sequence one after the other, and a pass
+ * at the end of the compilation of each function, that rewrites the first
+ * opcode of every such sequence in place */
+#define IS_OPCODE_CHAR(c) ((c) == '_' || ((c) >= 'A' && (c) <= 'Z') || ((c) >= '0' && (c) <= '9'))
+
+/* returns 1 when a sequence is added, 0 when the text does not start with two
+ * or more opcodes, and -1 on error */
+int add_fused (lang_t *this, char *seq) {
+  fused_t f;
+  f.len = 0;
+  f.name[0] = '\0';
+
+  char *sp = seq;
+  for (;;) {
+    while (*sp == ' ' || *sp == '\t' || *sp == ',' || *sp == '+') sp++;
+
+    if (*sp < 'A' || *sp > 'Z')
+      break;
+
+    char *end = sp;
+    while (IS_OPCODE_CHAR (*end)) end++;
+
+    /* the first word that is not an opcode ends the sequence */
+    if (*end && NULL == strchr (" \t,+\n", *end))
+      break;
+
+    if (f.len == MAX_FUSED_LEN || end - sp > 31) {
+      fprintf (stderr, "%s: expected up to %d opcode names\n", seq, MAX_FUSED_LEN);
+      return -1;
+    }
+
+    snprintf (f.ops[f.len], 32, "%.*s", (int) (end - sp), sp);
+    size_t name_len = bytelen (f.name);
+    snprintf (f.name + name_len, sizeof (f.name) - name_len, "%s%s",
+        f.len ? "__" : "", f.ops[f.len]);
+    f.len++;
+    sp = end;
+  }
+
+  if (f.len < 2)
+    return 0;
+
+  for (int i = 0; i < this->num_fused; i++)
+    if (str_eq (this->fused[i].name, f.name))
+      return 1;
+
+  if (this->num_fused == MAX_FUSED) {
+    fprintf (stderr, "--fuse: more than %d sequences\n", MAX_FUSED);
+    return -1;
+  }
+
+  this->fused[this->num_fused++] = f;
+
+  for (int i = 0; i < f.len; i++) {
+    int j = 0;
+    while (j < this->num_case_bodies && 0 == str_eq (this->case_bodies[j].name, f.ops[i]))
+      j++;
+
+    if (j == this->num_case_bodies) {
+      case_body_t *cb = &this->case_bodies[this->num_case_bodies++];
+      snprintf (cb->name, sizeof (cb->name), "%s", f.ops[i]);
+      cb->body = NULL;
+      cb->len = 0;
+    }
+  }
+
+  return 1;
+}
+
+int read_fuse_file (lang_t *this, char *file) {
+  FILE *fp = fopen (file, "r");
+  if (NULL == fp) {
+    fprintf (stderr, "fopen(): %s\n%s\n", file, strerror (errno));
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t len = 0;
+  int retval = 0;
+
+  while (-1 != getline (&line, &len, fp))
+    if (line[0] != '#' && -1 == add_fused (this, line)) {
+      retval = -1;
+      break;
+    }
+
+  free (line);
+  fclose (fp);
+  return retval;
+}
+
+/* the opcode names of opcodes.h, in order */
+int read_opcodes (lang_t *this) {
+  this->num_opcodes = 0;
+
+  char file[this->lang_c_dir_len + 16];
+  snprintf (file, sizeof (file), "%s/vm/opcodes.h", this->lang_c_dir);
+
+  FILE *fp = fopen (file, "r");
+  if (NULL == fp) {
+    fprintf (stderr, "fopen(): %s\n%s\n", file, strerror (errno));
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t len = 0;
+
+  while (-1 != getline (&line, &len, fp)) {
+    char *sp = line;
+    while (*sp == ' ') sp++;
+
+    if (0 == str_eq_n (sp, "OPCODE(", 7) || this->num_opcodes == MAX_OPCODES)
+      continue;
+
+    sp += 7;
+    char *end = sp;
+    while (IS_OPCODE_CHAR (*end)) end++;
+
+    snprintf (this->opcodes[this->num_opcodes++], 32, "%.*s", (int) (end - sp), sp);
+  }
+
+  free (line);
+  fclose (fp);
+  return 0;
+}
+
+int is_opcode (lang_t *this, const char *name) {
+  for (int i = 0; i < this->num_opcodes; i++)
+    if (str_eq (this->opcodes[i], name))
+      return 1;
+
+  return 0;
+}
+
+/* the opcodes that run() checks its safepoint at, before their DISPATCH():
+ * the backward jump and every call site */
+static const char *safepoint_ops[] = {
+  "LOOP", "CALL", "INVOKE", "INVOKE_SUPER", "SUPER"
+};
+
+int is_safepoint_op (const char *name, size_t len) {
+  for (size_t i = 0; i < ARRLEN (safepoint_ops); i++)
+    if (bytelen (safepoint_ops[i]) == len && str_eq_n (safepoint_ops[i], name, len))
+      return 1;
+
+  return 0;
+}
+
+/* every fused opcode exists, and the opcodes lmake adds still fit a byte */
+int check_fused (lang_t *this) {
+  for (int i = 0; i < this->num_case_bodies; i++)
+    if (0 == is_opcode (this, this->case_bodies[i].name)) {
+      fprintf (stderr, "--fuse: %s is not an opcode of %s/vm/opcodes.h\n",
+          this->case_bodies[i].name, this->lang_c_dir);
+      return -1;
+    }
+
+  if (this->num_opcodes + this->num_fused + 1 > 256) {
+    fprintf (stderr, "--fuse: %d opcodes and %d superinstructions do not fit a byte\n",
+        this->num_opcodes, this->num_fused);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* the optimizer needs these opcodes, and to know every jump; the forward
+ * jumps are JUMP and JUMP_IF_*, the backward one is LOOP */
+char *opt_opcodes[] = {
+  "CONSTANT", "TRUE", "FALSE", "NIL", "NOT", "NEGATE", "ADD", "SUBTRACT",
+  "MULTIPLY", "DIVIDE", "GREATER", "LESS", "EQUAL", "JUMP", "JUMP_IF_FALSE",
+  "LOOP", "POP", "RETURN", "GET_LOCAL", "SET_LOCAL", "GET_UPVALUE", "SET_UPVALUE"
+};
+
+int write_optimizer (lang_t *this) {
+  fprintf (this->fp_out, "\n/*** OPTIMIZER ***/\n\n#define OPT_FORWARD_JUMP(op) (");
+
+  const char *disabled = NULL;
+  int num_jumps = 0;
+
+  for (int i = 0; i < this->num_opcodes; i++) {
+    char *name = this->opcodes[i];
+
+    if (str_eq (name, "JUMP") || str_eq_n (name, "JUMP_IF_", 8))
+      fprintf (this->fp_out, "%s(op) == OP_%s", num_jumps++ ? " || " : "", name);
+    else if ((strstr (name, "JUMP") || strstr (name, "LOOP")) && 0 == str_eq (name, "LOOP"))
+      disabled = name;
+  }
+
+  fprintf (this->fp_out, "%s)\n", num_jumps ? "" : "0");
+
+  for (size_t i = 0; i < ARRLEN (opt_opcodes); i++)
+    if (0 == is_opcode (this, opt_opcodes[i]))
+      disabled = opt_opcodes[i];
+
+  if (this->has_nops)
+    disabled = "NOPS";
+
+  if (disabled) {
+    fprintf (stderr, "warning: the optimizer is disabled, as it does not know the %s opcode\n",
+        disabled);
+    fprintf (this->fp_out, "#define OPT_DISABLED\n");
+  }
+
+  fprintf (this->fp_out, "\n");
+  if (-1 == write_src_file (this, OPTIMIZE_EXT))
+    return -1;
+
+  fprintf (this->fp_out, "\n#undef OPT_FORWARD_JUMP\n/*** OPTIMIZER END ***/\n");
+  return 0;
+}
+
+/* whether a case jumps or switches the frame, so it can only end a sequence;
+ * besides assignments to ip and frame, a macro with FRAME in its name, that
+ * reloads them (STORE_FRAME only saves ip, it is fine) */
+int case_moves_ip (char *body) {
+  for (char *sp = body; *sp; sp++) {
+    if (sp > body && (IS_OPCODE_CHAR (sp[-1]) || (sp[-1] >= 'a' && sp[-1] <= 'z') ||
+        sp[-1] == '>' || sp[-1] == '.'))
+      continue;
+
+    if (*sp >= 'A' && *sp <= 'Z') {
+      char *id_end = sp;
+      while (IS_OPCODE_CHAR (*id_end)) id_end++;
+
+      size_t id_len = id_end - sp;
+      for (size_t i = 0; i + 5 <= id_len; i++)
+        if (str_eq_n (sp + i, "FRAME", 5) &&
+            0 == (id_len == 11 && str_eq_n (sp, "STORE_FRAME", 11)))
+          return 1;
+
+      continue;
+    }
+
+    char *end;
+    if (str_eq_n (sp, "ip", 2))
+      end = sp + 2;
+    else if (str_eq_n (sp, "frame", 5))
+      end = sp + 5;
+    else
+      continue;
+
+    if (IS_OPCODE_CHAR (*end) || (*end >= 'a' && *end <= 'z'))
+      continue;
+
+    while (*end == ' ') end++;
+
+    if ((end[0] == '=' && end[1] != '=') ||
+        ((end[0] == '+' || end[0] == '-') && (end[1] == '=' || end[1] == end[0])))
+      return 1;
+  }
+
+  return 0;
+}
+
+void append_case_body (case_body_t *cb, char *line) {
+  size_t len = bytelen (line);
+  cb->body = Realloc (cb->body, cb->len + len + 1);
+  memcpy (cb->body + cb->len, line, len + 1);
+  cb->len += len;
+}
+
+case_body_t *find_case_body (lang_t *this, char *name, size_t len) {
+  for (int i = 0; i < this->num_case_bodies; i++)
+    if (bytelen (this->case_bodies[i].name) == len &&
+        str_eq_n (this->case_bodies[i].name, name, len))
+      return &this->case_bodies[i];
+
+  return NULL;
+}
+
+/* the cases of the opcodes lmake adds: NOPS, the filler of the optimizer,
+ * that skips a run of them in one dispatch, and the superinstructions; a
+ * superinstruction is the captured cases of its opcodes, each in a block
+ * where a DISPATCH() goes on to the next one, that first skips the opcode
+ * byte the compiler left in place; the last case dispatches as it is */
+int write_run_cases (lang_t *this) {
+  if (0 == this->has_nops)
+    fprintf (this->fp_out, "\n"
+        "        CASE_CODE(NOPS): {\n"
+        "            while (*ip == OP_NOPS)\n"
+        "                ip++;\n"
+        "            DISPATCH();\n"
+        "        }\n");
+
+  if (this->num_fused)
+    fprintf (this->fp_out, "\n        /* superinstructions (lmake --fuse) */\n");
+
+  for (int k = 0; k < this->num_fused; k++) {
+    fused_t *f = &this->fused[k];
+    fprintf (this->fp_out, "        CASE_CODE(%s): {\n", f->name);
+
+    for (int i = 0; i < f->len; i++) {
+      case_body_t *cb = find_case_body (this, f->ops[i], bytelen (f->ops[i]));
+      int last = i == f->len - 1;
+
+      if (NULL == cb || NULL == cb->body) {
+        fprintf (stderr, "--fuse: no CASE_CODE(%s) in run()\n", f->ops[i]);
+        return -1;
+      }
+
+      if (0 == last && case_moves_ip (cb->body)) {
+        fprintf (stderr, "--fuse: %s: %s jumps or calls, it can only end a sequence\n",
+            f->name, f->ops[i]);
+        return -1;
+      }
+
+      int safepoint = last && is_safepoint_op (f->ops[i], bytelen (f->ops[i]));
+      int jumps = 0;
+
+      /* the cases are blocks mostly, otherwise they are put in one */
+      char *line = cb->body;
+      char *body_end = line + cb->len;
+      while (body_end > line && (body_end[-1] == '\n' || body_end[-1] == ' '))
+        body_end--;
+
+      int block = str_eq_n (line, " {\n", 3);
+      if (block)
+        line += 3;
+
+      fprintf (this->fp_out, "        {%s", block ? "\n" : "");
+
+      while (line < body_end) {
+        char *eol = strchr (line, '\n');
+        size_t len = (eol && eol < body_end) ? (size_t) (eol - line) + 1 : (size_t) (body_end - line);
+
+        char *sp = line;
+        while (*sp == ' ') sp++;
+
+        if (safepoint && str_eq_n (sp, "DISPATCH();\n", 12))
+          fprintf (this->fp_out, "%.*sVM_SAFEPOINT();\n", (int) (sp - line), line);
+
+        char *d;
+        while (0 == last && (d = strstr (line, "DISPATCH()")) && d < line + len) {
+          fprintf (this->fp_out, "%.*sgoto fused_%d_%d", (int) (d - line), line, k, i);
+          len -= (d + 10) - line;
+          line = d + 10;
+          jumps++;
+        }
+
+        fprintf (this->fp_out, "%.*s", (int) len, line);
+        line += len;
+      }
+
+      fprintf (this->fp_out, "%s", block ? "\n" : "\n        }\n");
+
+      if (last)
+        continue;
+
+      if (jumps)
+        fprintf (this->fp_out, "        fused_%d_%d: ip++;\n", k, i);
+      else
+        fprintf (this->fp_out, "        ip++;\n");
+    }
+
+    fprintf (this->fp_out, "        }\n\n");
+  }
+
+  this->opcode_hooks |= 2;
+  return 0;
+}
+
+/* captures the cases of run() that make the superinstructions, and writes
+ * the cases lmake adds at the end of its loop */
+int parse_vm_run_loop (lang_t *this, char *line) {
+  if (str_eq (line, "static DictuInterpretResult run(DictuVM *vm) {\n")) {
+    this->in_run_loop = 1;
+    return PARSELINE_OK;
+  }
+
+  if (0 == this->in_run_loop)
+    return PARSELINE_OK;
+
+  char *label = strstr (line, "CASE_CODE(");
+  if (label && NULL == strstr (line, "#define")) {
+    this->in_run_loop = 2;
+    this->case_body = NULL;
+
+    char *name = label + 10;
+    char *end = strchr (name, ')');
+    if (NULL == end || end[1] != ':')
+      return PARSELINE_OK;
+
+    this->case_body = find_case_body (this, name, end - name);
+    if (this->case_body)
+      append_case_body (this->case_body, end + 2);
+
+    return PARSELINE_OK;
+  }
+
+  if (this->in_run_loop == 2 && str_eq (line, "    }\n")) {
+    this->in_run_loop = 0;
+    this->case_body = NULL;
+    if (-1 == write_run_cases (this))
+      return PARSELINE_BREAK;
+    return PARSELINE_OK;
+  }
+
+  if (this->case_body)
+    append_case_body (this->case_body, line);
+
+  return PARSELINE_OK;
+}
+
+/* the pass of the compiler, after the fused sequences, longest first */
+void write_fused_pass (lang_t *this) {
+  fprintf (this->fp_out, "\n/*** SUPERINSTRUCTIONS ***/\n\n"
+      "static const struct {\n"
+      "    int len;\n"
+      "    uint8_t ops[%d];\n"
+      "    uint8_t fused;\n"
+      "} fusedOps[] = {\n", MAX_FUSED_LEN);
+
+  for (int len = MAX_FUSED_LEN; len >= 2; len--)
+    for (int k = 0; k < this->num_fused; k++) {
+      fused_t *f = &this->fused[k];
+      if (f->len != len)
+        continue;
+
+      fprintf (this->fp_out, "    {%d, {", len);
+      for (int i = 0; i < len; i++)
+        fprintf (this->fp_out, "%sOP_%s", i ? ", " : "", f->ops[i]);
+      fprintf (this->fp_out, "}, OP_%s},\n", f->name);
+    }
+
+  fprintf (this->fp_out, "};\n\n"
+      "// the first opcode of a fused sequence is rewritten in place, while its\n"
+      "// operands and the opcodes that follow stay, so no instruction length or\n"
+      "// jump offset changes, and a jump into the sequence runs the plain opcodes\n"
+      "static void fuseChunk(Chunk *chunk) {\n"
+      "    int ip = 0;\n\n"
+      "    while (ip < chunk->count) {\n"
+      "        int next = ip + 1 + getArgCount(chunk->code, chunk->constants, ip);\n\n"
+      "        for (size_t i = 0; i < sizeof(fusedOps) / sizeof(fusedOps[0]); i++) {\n"
+      "            int at = ip, n = 0;\n\n"
+      "            while (n < fusedOps[i].len && at < chunk->count && chunk->code[at] == fusedOps[i].ops[n]) {\n"
+      "                at += 1 + getArgCount(chunk->code, chunk->constants, at);\n"
+      "                n++;\n"
+      "            }\n\n"
+      "            if (n == fusedOps[i].len) {\n"
+      "                chunk->code[ip] = fusedOps[i].fused;\n"
+      "                break;\n"
+      "            }\n"
+      "        }\n\n"
+      "        ip = next;\n"
+      "    }\n"
+      "}\n\n"
+      "/*** SUPERINSTRUCTIONS END ***/\n");
+}
+
+/* file imports go through vm_read_file(), that traces them */
+int parse_vm_import (lang_t *this, char *line) {
+  char *tmp = strstr (line, "readFile(vm, ");
+  if (NULL == tmp)
+    return PARSELINE_OK;
+
+  fprintf (this->fp_out, "%.*svm_read_file(%s", (int) (tmp - line), line,
+      strchr (tmp, '(') + 1);
+  return PARSELINE_NEXT_LINE;
+}
+
+int parse_vm_h (lang_t *this, char *line, size_t len) {
+  (void) len;
+  if (str_eq (line, "struct _vm {\n")) {
+    if (-1 == write_src_file (this, VM_TYPES))
+      return PARSELINE_BREAK;
+
+    this->in_vm_struct = 1;
+    return PARSELINE_OK;
+  }
+
+  if (this->in_vm_struct && str_eq (line, "};\n")) {
+    this->in_vm_struct = 0;
+    if (-1 == write_src_file (this, VM_FIELDS))
+      return PARSELINE_BREAK;
+  }
+
+  return PARSELINE_OK;
+}
+
+int parse_vm (lang_t *this, char *line, size_t len) {
+  (void) len;
+  int retval = parse_vm_run_loop (this, line);
+  if (retval != PARSELINE_OK)
+    return retval;
+
+  if (strstr (line, "memset(vm, '\\0', sizeof(DictuVM));")) {
+    fprintf (this->fp_out, "%s"
+        "    vm_allocator_setup(vm, allocator);\n"
+        "    vm_gc_setup(vm);\n"
+        "    vm_trace_env();\n", line);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  if (strstr (line, "vm->nextGC = 1024 * 1024;")) {
+    fprintf (this->fp_out, "%.*svm_gc_next(vm);\n", (int) (strstr (line, "vm->") - line), line);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  /* run() is wrapped, so the safepoints know whether a native called back
+   * into a nested run(), and a time slice starts with the outermost one */
+  if (str_eq (line, "static DictuInterpretResult run(DictuVM *vm) {\n")) {
+    fprintf (this->fp_out,
+        "static DictuInterpretResult runLoop(DictuVM *vm);\n\n"
+        "%s"
+        "    if (vm->runDepth++ == 0)\n"
+        "        vm_slice_start(vm);\n\n"
+        "    DictuInterpretResult result = runLoop(vm);\n"
+        "    vm->runDepth--;\n"
+        "    return result;\n}\n\n"
+        "static DictuInterpretResult runLoop(DictuVM *vm) {\n", line);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  /* trace points: dictuInterpret() is wrapped, and the compile and native
+   * calls of run() go through the vm_trace_ functions, when tracing */
+  if (str_eq (line, "DictuInterpretResult dictuInterpret(DictuVM *vm, char *moduleName, char *source) {\n")) {
+    fprintf (this->fp_out,
+        "static DictuInterpretResult interpretSource(DictuVM *vm, char *moduleName, char *source);\n\n"
+        "%s"
+        "    if (vm_trace_file == NULL)\n"
+        "        return interpretSource(vm, moduleName, source);\n\n"
+        "    uint64_t start = vm_clock_ns();\n"
+        "    DictuInterpretResult result = interpretSource(vm, moduleName, source);\n"
+        "    vm_trace_event(\"interpret\", \"interpret\", start, vm_clock_ns(), moduleName);\n"
+        "    return result;\n}\n\n"
+        "static DictuInterpretResult interpretSource(DictuVM *vm, char *moduleName, char *source) {\n",
+        line);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  char *call = strstr (line, " compile(vm, ");
+  if (call) {
+    fprintf (this->fp_out, "%.*s vm_trace_compile(vm, %s", (int) (call - line), line, call + 13);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  call = strstr (line, "native(vm, argCount, ");
+  if (call && (call == line || call[-1] == ' ' || call[-1] == '=')) {
+    fprintf (this->fp_out, "%.*svm_call_native(native, vm, argCount, %s",
+        (int) (call - line), line, call + 21);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  char *read = strstr (line, "instruction = READ_BYTE()");
+  if (read) {
+    fprintf (this->fp_out, "%.*sinstruction = VM_OPSTAT(READ_BYTE())%s",
+        (int) (read - line), line, read + 25);
+    return PARSELINE_NEXT_LINE;
+  }
+
+  char *case_code = strstr (line, "CASE_CODE(");
+  if (case_code) {
+    char *name = case_code + 10;
+    char *name_end = strchr (name, ')');
+    if (name_end && name_end[1] == ':' && is_safepoint_op (name, name_end - name)) {
+      this->in_safepoint_case = 1;
+      return PARSELINE_OK;
+    }
+  }
+
+  if (this->in_safepoint_case) {
+    char *sp = line;
+    while (*sp == ' ') sp++;
+
+    if (str_eq (sp, "DISPATCH();\n"))
+      fprintf (this->fp_out, "%.*sVM_SAFEPOINT();\n", (int) (sp - line), line);
+    else if (strstr (line, "CASE_CODE("))
+      this->in_safepoint_case = 0;
+
+    return PARSELINE_OK;
+  }
+
+  if (PARSELINE_OK != parse_vm_import (this, line))
+    return PARSELINE_NEXT_LINE;
+
+  /* dictuInitVM() becomes dictuInitVMWithAllocator(), with the allocator
+   * set right after the vm is zeroed, before anything is allocated */
+  if (str_eq_n (line, "DictuVM *dictuInitVM(", 21)) {
+    if (0 == str_eq (line, "DictuVM *dictuInitVM(bool repl, int argc, char *argv[]) {\n")) {
+      fprintf (stderr, "unexpected dictuInitVM() signature: %s", line);
+      return PARSELINE_BREAK;
+    }
+
+    this->in_init_vm = 1;
+    fprintf (this->fp_out,
+        "DictuVM *dictuInitVM(bool repl, int argc, char *argv[]) {\n"
+        "    return dictuInitVMWithAllocator(repl, argc, argv, NULL);\n"
+        "}\n\n"
+        "DictuVM *dictuInitVMWithAllocator(bool repl, int argc, char *argv[], DictuAllocator *allocator) {\n");
+    return PARSELINE_NEXT_LINE;
+  }
+
+  if (this->in_init_vm && str_eq (line, "    return vm;\n")) {
+    this->in_init_vm = 0;
+    fprintf (this->fp_out, "    vm_reset_snapshot(vm);\n");
+    return PARSELINE_OK;
+  }
+
+  if (str_eq (line, "void dictuFreeVM(DictuVM *vm) {\n")) {
+    fprintf (this->fp_out, "%s"
+        "#ifdef ENABLE_PROFILER\n"
+        "    vm_profiler_stop(vm);\n"
+        "#endif\n\n"
+        "#ifdef ENABLE_OPSTATS\n"
+        "    vm_opstats_dump(stderr);\n"
+        "#endif\n\n"
+        "    free(vm->marks.pages);\n\n"
+        "    if (vm_allocator_discard(vm))\n"
+        "        return;\n\n"
+        "    freeTable(vm, &vm->baseGlobals);\n"
+        "    freeTable(vm, &vm->baseModules);\n", line);
+    return PARSELINE_NEXT_LINE;
+  }
 
   return PARSELINE_OK;
 }
 
-int parse_env (lang_t *this, char *line, size_t len) {
-  char prefix[] = "env_";
-  size_t pr_len = 4;
-  char *tmp = strstr (line, "get(");
-  if (tmp) {
-    line = insert_str (this, line, len, tmp, prefix, pr_len);
-    return PARSELINE_OK;
+int parse_memory (lang_t *this, char *line, size_t len) {
+  (void) len;
+  if (this->skip_reallocate) {
+    if (str_eq (line, "}\n"))
+      this->skip_reallocate = 0;
+    return PARSELINE_NEXT_LINE;
   }
 
-  tmp = strstr (line, "get)");
-  if (tmp)
-    line = insert_str (this, line, len, tmp, prefix, pr_len);
-
-  return PARSELINE_OK;
-}
+  char *tmp = strstr (line, "grayTable(vm, &vm->globals);");
+  if (tmp) {
+    fprintf (this->fp_out, "%s"
+        "%.*sgrayTable(vm, &vm->baseGlobals);\n"
+        "%.*sgrayTable(vm, &vm->baseModules);\n",
+        line, (int) (tmp - line), line, (int) (tmp - line), line);
+    return PARSELINE_NEXT_LINE;
+  }
 
-int parse_system (lang_t *this, char *line, size_t len) {
-  char pat[] = "defineNative(vm, &klass->methods, \"exit\", exitNative);\n";
-  size_t plen = bytelen (pat);
+  if (str_eq_n (line, "void *reallocate(DictuVM *vm,", 29)) {
+    if (-1 == write_src_file (this, REALLOCATE))
+      return PARSELINE_BREAK;
 
-  if (len < plen)
-    return PARSELINE_OK;
+    this->skip_reallocate = 1;
+    return PARSELINE_NEXT_LINE;
+  }
 
-  ifnot (this->disable_exit)
-    return PARSELINE_OK;
+  /* vm->finalizers counts the live objects that a discarded heap still has
+   * to finalize, so the discard walks the objects only when there are some */
+  if (str_eq_n (line, "void freeObject(", 16) || str_eq_n (line, "static void freeObject(", 23)) {
+    if (0 == str_eq (strstr (line, "void freeObject("), "void freeObject(DictuVM *vm, Obj *object) {\n")) {
+      fprintf (stderr, "unexpected freeObject() signature\n");
+      return PARSELINE_BREAK;
+    }
 
+    fprintf (this->fp_out, "%s"
+        "    if (VM_OBJ_FINALIZED(object))\n"
+        "        vm->finalizers--;\n\n", line);
+    return PARSELINE_NEXT_LINE;
+  }
 
-  char dis_txt[] = "/*** DISABLED ***/\n    (void) exitNative;\n    // ";
-  size_t dis_len = bytelen (dis_txt);
+  if (str_eq (line, "void collectGarbage(DictuVM *vm) {\n")) {
+    fprintf (this->fp_out, "%s"
+        "    uint64_t gcStart = vm_clock_ns();\n"
+        "    uint64_t gcSweepStart = 0;\n", line);
+    return PARSELINE_NEXT_LINE;
+  }
 
-  char *tmp = strstr (line, pat);
-  if (tmp)
-    line = insert_str (this, line, len, tmp, dis_txt, dis_len);
+  tmp = strstr (line, "tableRemoveWhite(vm, &vm->strings);");
+  if (tmp) {
+    fprintf (this->fp_out, "%.*sgcSweepStart = vm_clock_ns();\n%s", (int) (tmp - line), line, line);
+    return PARSELINE_NEXT_LINE;
+  }
 
-  return PARSELINE_OK;
-}
+  tmp = strstr (line, "vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;");
+  if (tmp) {
+    fprintf (this->fp_out,
+        "%.*svm_gc_next(vm);\n"
+        "%.*svm_gc_pause(vm, gcStart, gcSweepStart);\n",
+        (int) (tmp - line), line, (int) (tmp - line), line);
+    return PARSELINE_NEXT_LINE;
+  }
 
-int parse_jsonBuilderLib (lang_t *this, char *line, size_t len) {
-  (void) this; (void) len;
-  char *tmp = strstr (line, "default_opts");
+  tmp = strstr (line, "FREE_ARRAY(vm, char, string->chars, string->length + 1);");
   if (tmp) {
-    tmp[0] = 'D';
-    tmp[8] = 'O';
+    int indent = (int) (tmp - line);
+    fprintf (this->fp_out,
+        "%*sif (string->release != NULL)\n"
+        "%*s    string->release(string->releaseData, string->chars, string->length);\n"
+        "%*selse\n"
+        "    %s",
+        indent, "", indent, "", indent, "", line);
+    return PARSELINE_NEXT_LINE;
   }
 
   return PARSELINE_OK;
 }
 
-int parse_jsonParseLib (lang_t *this, char *line, size_t len) {
-  char *tmp = strstr (line, "uchar");
-  while (tmp) {
-    if (*(tmp-1) != '_' || *(tmp+5) != '2') {
-      line = insert_str (this, line, len, tmp, "l_", 2);
-      len += 2;
+/* with --gc-mark-bitmap, the Obj.isDark reads and writes in memory.c and
+ * table.c go to the page mark bitmaps of ext_marks.c; clearing isDark in
+ * the sweep is dropped, as the bitmaps are cleared after it */
+int parse_mark_bits (lang_t *this, char *line) {
+  char *match = strstr (line, "isDark");
+  if (NULL == match) {
+    char *sp = line;
+    while (*sp == ' ') sp++;
+    if (str_eq (sp, "sweep(vm);\n")) {
+      fprintf (this->fp_out, "%s%.*svm_mark_clear(vm);\n", line, (int) (sp - line), line);
+      return PARSELINE_NEXT_LINE;
     }
 
-    tmp = strstr (tmp + 5, "uchar");
+    return PARSELINE_OK;
   }
 
-  return PARSELINE_OK;
-}
+  char *sp = line;
+
+  while (match) {
+    int deref = match - line >= 2 && match[-1] == '>' && match[-2] == '-';
+    char *end = match - (deref ? 2 : 1);
+    if (deref == 0 && (match == line || *end != '.'))
+      return PARSELINE_OK;
+
+    char *expr = end;
+    while (expr > sp) {
+      char c = expr[-1];
+      if (c == '_' || c == '.' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9'))
+        expr--;
+      else if (c == '>' && expr - 1 > sp && expr[-2] == '-')
+        expr -= 2;
+      else
+        break;
+    }
 
-int parse_sqlite (lang_t *this, char *line, size_t len) {
-  char prefix[] = "sqlite_";
-  size_t pr_len = 7;
+    char *after = match + 6;
+    if (str_eq_n (after, " = false;", 9)) {
+      char *ws = expr;
+      while (ws > line && ws[-1] == ' ') ws--;
+      if (ws == line && str_eq (after + 9, "\n"))
+        return PARSELINE_NEXT_LINE;
+    }
 
-  char *tmp = strstr (line, "execute");
-  while (tmp) {
-    line = insert_str (this, line, len, tmp, prefix, pr_len);
-    len += pr_len;
-    tmp = strstr(tmp + 14, "execute");
+    fprintf (this->fp_out, "%.*s", (int) (expr - sp), sp);
+
+    if (str_eq_n (after, " = false;", 9)) {
+      after += 9;
+    } else if (str_eq_n (after, " = true;", 8)) {
+      fprintf (this->fp_out, "vm_mark_set(vm, %s%.*s);",
+          deref ? "" : "&", (int) (end - expr), expr);
+      after += 8;
+    } else {
+      fprintf (this->fp_out, "vm_mark_test(vm, %s%.*s)",
+          deref ? "" : "&", (int) (end - expr), expr);
+    }
+
+    sp = after;
+    match = strstr (sp, "isDark");
   }
 
-  return PARSELINE_OK;
+  fprintf (this->fp_out, "%s", sp);
+  return PARSELINE_NEXT_LINE;
 }
 
-int parse_optionals (lang_t *this, char *line, size_t len) {
-  if (strstr (line, "Sqlite")) {
-    line = insert_str (this, line, len, line,
-        "#ifndef DISABLE_SQLITE\n", 23);
+/* with --lazy-natives, the declare<Type>Methods(vm) calls in dictuInitVM()
+ * are dropped and the method tables are filled on their first use */
+int parse_lazy_declare (lang_t *this, char *line) {
+  char *sp = line;
+  while (*sp == ' ') sp++;
 
-    char *ptr = line + len + 23;
-    line = insert_str (this, line, len + 23, ptr,
-     "#endif /* DISABLE_SQLITE */\n", 28);
-  }
+  if (0 == str_eq_n (sp, "declare", 7))
+    return PARSELINE_OK;
 
-  return PARSELINE_OK;
+  char *end = strstr (sp, "Methods(vm);\n");
+  if (NULL == end || end[13] != '\0' || end - (sp + 7) >= 24)
+    return PARSELINE_OK;
+
+  if (this->num_lazy_methods == MAX_NATIVE_TABLES)
+    return PARSELINE_OK;
+
+  str_cp (this->lazy_methods[this->num_lazy_methods++], 32, sp + 7, end - (sp + 7));
+  return PARSELINE_NEXT_LINE;
 }
 
-int parse_datetime (lang_t *this, char *line, size_t len) {
-  (void) this; (void) len; (void) len;
-  return PARSELINE_OK;
+/* a table is declared once, as its bit in vm->lazyDeclared says; a type
+ * without methods leaves its table empty, so the count can't tell */
+int write_lazy_methods (lang_t *this) {
+  fprintf (this->fp_out,
+      "Table *vm_lazy_methods(DictuVM *vm, Table *table) {\n"
+      "    if (table->count != 0)\n"
+      "        return table;\n\n");
 
-  char *tmp = strstr (line, "XOPEN");
-  if (tmp)
-    return PARSELINE_NEXT_LINE;
+  for (int i = 0; i < this->num_lazy_methods; i++) {
+    char *type = this->lazy_methods[i];
+    fprintf (this->fp_out,
+        "%sif (table == &vm->%c%sMethods) {\n"
+        "        if (0 == (vm->lazyDeclared & (UINT32_C(1) << %d))) {\n"
+        "            vm->lazyDeclared |= UINT32_C(1) << %d;\n"
+        "            declare%sMethods(vm);\n"
+        "        }\n"
+        "    }",
+        i ? " else " : "    ", type[0] + ('a' - 'A') * (type[0] >= 'A' && type[0] <= 'Z'),
+        type + 1, i, i, type);
+  }
 
-  return PARSELINE_OK;
+  fprintf (this->fp_out, "\n\n    return table;\n}\n\n");
+  return 0;
 }
 
-int line_cb (lang_t *this, char *file, char *line, size_t len) {
-  if (0 == strncmp ("#include", line, 8))
-    return PARSELINE_NEXT_LINE;
-
-  if (strstr (file, "sqlite"))
-    return parse_sqlite (this, line, len);
+#define IS_IDENT_CHAR(c) (IS_OPCODE_CHAR (c) || ((c) >= 'a' && (c) <= 'z'))
 
-  if (strstr (file, "compiler.c"))
-    return parse_compiler (this, line, len);
+/* every &vm->xMethods and vm->xMethods. goes through vm_lazy_methods(), so
+ * lookups, iteration and reflection all see the declared table; the calls
+ * that declare, initialize, mark or free the tables use them as they are */
+int parse_lazy_lookup (lang_t *this, char *line) {
+  static const char *raw[] = {
+    "defineNative", "initTable(", "freeTable(", "grayTable(", "markTable("
+  };
 
-  if (strstr (file, "scanner.c"))
-    return parse_scanner (this, line, len);
+  char *match = strstr (line, "vm->");
+  if (NULL == match)
+    return PARSELINE_OK;
 
-  if (strstr (file, "class.c"))
-    return parse_class (this, line, len);
+  for (size_t i = 0; i < ARRLEN (raw); i++)
+    if (strstr (line, raw[i]))
+      return PARSELINE_OK;
+
+  char *sp = line;
+  int found = 0;
+
+  while (match) {
+    char *name = match + 4;
+    char *end = name;
+    while (IS_IDENT_CHAR (*end))
+      end++;
+
+    int is_table = end - name > 7 && str_eq_n (end - 7, "Methods", 7) &&
+        (match == line || 0 == IS_IDENT_CHAR (match[-1]));
+
+    /* the expression of the vm, as vm or parser->vm */
+    char *expr = match;
+    while (expr > sp && (IS_IDENT_CHAR (expr[-1]) || expr[-1] == '.' ||
+        (expr[-1] == '>' && expr - 1 > sp && expr[-2] == '-')))
+      expr -= expr[-1] == '>' ? 2 : 1;
+
+    int vm_len = (int) (match - expr) + 2;
+
+    if (is_table && expr > line && expr[-1] == '&') {
+      fprintf (this->fp_out, "%.*svm_lazy_methods(%.*s, &%.*s->%.*s)",
+          (int) (expr - 1 - sp), sp, vm_len, expr, vm_len, expr, (int) (end - name), name);
+      sp = end;
+      found = 1;
+    } else if (is_table && *end == '.') {
+      fprintf (this->fp_out, "%.*svm_lazy_methods(%.*s, &%.*s->%.*s)->",
+          (int) (expr - sp), sp, vm_len, expr, vm_len, expr, (int) (end - name), name);
+      sp = end + 1;
+      found = 1;
+    } else if (is_table) {
+      fprintf (stderr, "warning: --lazy-natives: an access of %.*s is not routed: %s",
+          (int) (end - name), name, line);
+    }
 
-  if (strstr (file, "env.c"))
-    return parse_env (this, line, len);
+    match = strstr (end, "vm->");
+  }
 
-  if (strstr (file, "system.c"))
-    return parse_system (this, line, len);
+  if (0 == found)
+    return PARSELINE_OK;
 
-  if (strstr (file, "jsonBuilderLib.c"))
-    return parse_jsonBuilderLib (this, line, len);
+  fprintf (this->fp_out, "%s", sp);
+  return PARSELINE_NEXT_LINE;
+}
 
-  if (strstr (file, "jsonParseLib.c"))
-    return parse_jsonParseLib (this, line, len);
+int line_cb (lang_t *this, char *file, char *line, size_t len) {
+  if (0 == strncmp ("#include", line, 8))
+    return PARSELINE_NEXT_LINE;
 
-  if (strstr (file, "datetime.h"))
-    return parse_datetime (this, line, len);
+  int retval = PARSELINE_OK;
 
-  if (strstr (file, "optionals.c"))
-    return parse_optionals (this, line, len);
+  if (strstr (file, "sqlite")) {
+    retval = parse_sqlite (this, line, len);
+  } else if (strstr (file, "compiler.c")) {
+    retval = parse_compiler (this, line, len);
+  } else if (strstr (file, "scanner.c")) {
+    retval = parse_scanner (this, line, len);
+  } else if (strstr (file, "class.c")) {
+    retval = parse_class (this, line, len);
+  } else if (strstr (file, "env.c")) {
+    retval = parse_env (this, line, len);
+  } else if (strstr (file, "system.c")) {
+    retval = parse_system (this, line, len);
+  } else if (strstr (file, "jsonBuilderLib.c")) {
+    retval = parse_jsonBuilderLib (this, line, len);
+  } else if (strstr (file, "jsonParseLib.c")) {
+    retval = parse_jsonParseLib (this, line, len);
+  } else if (strstr (file, "datetime.h")) {
+    retval = parse_datetime (this, line, len);
+  } else if (strstr (file, "optionals.c")) {
+    retval = parse_optionals (this, line, len);
+  } else if (strstr (file, "object.h")) {
+    retval = parse_object_h (this, line, len);
+  } else if (strstr (file, "object.c")) {
+    retval = parse_object (this, line, len);
+  } else if (strstr (file, "memory.c")) {
+    retval = parse_memory (this, line, len);
+  } else if (strstr (file, "vm.h")) {
+    retval = parse_vm_h (this, line, len);
+  } else if (strstr (file, "vm.c")) {
+    retval = parse_vm (this, line, len);
+  }
+
+  if (PARSELINE_OK != retval)
+    return retval;
+
+  if (this->gc_mark_bitmap && this->exttype == C_TYPE) {
+    char *base = path_basename (file);
+    if (str_eq (base, "memory.c") || str_eq (base, "table.c"))
+      retval = parse_mark_bits (this, line);
+
+    if (PARSELINE_OK != retval)
+      return retval;
+  }
+
+  if (this->lazy_natives && this->exttype == C_TYPE) {
+    if (strstr (file, "vm.c"))
+      retval = parse_lazy_declare (this, line);
+
+    if (PARSELINE_OK == retval)
+      retval = parse_lazy_lookup (this, line);
+
+    if (PARSELINE_OK != retval)
+      return retval;
+  }
+
+  if (this->exttype == C_TYPE && this->base_dir != this->lang_c_dir)
+    return parse_define_native (this, file, line, len);
 
   return PARSELINE_OK;
 }
 
 int file_on_close_cb (lang_t *this, char *file) {
+  if (strstr (file, "compiler.c")) {
+    if (-1 == write_optimizer (this))
+      return PARSEFILE_BREAK;
+    if (this->num_fused)
+      write_fused_pass (this);
+    return PARSEFILE_OK;
+  }
+
   if (strstr (file, "sqlite")) {
     fprintf (this->fp_out, "\n#endif /* DISABLE_SQLITE */\n");
     return PARSEFILE_OK;
@@ -910,7 +2243,33 @@ int file_on_close_cb (lang_t *this, char *file) {
     return PARSEFILE_OK;
   }
 
+  if (strstr (file, "vm.h")) {
+    if (-1 == write_src_file (this, VM_PROTOS))
+      return PARSEFILE_BREAK;
+    return PARSEFILE_OK;
+  }
+
+  if (strstr (file, "memory.c")) {
+    fprintf (this->fp_out, "\n/*** MEMORY EXTENSIONS ***/\n\n");
+    if (this->gc_grow_factor)
+      fprintf (this->fp_out, "#define VM_GC_GROW_FACTOR %.17g\n", this->gc_grow_factor);
+    if (this->gc_min_heap)
+      fprintf (this->fp_out, "#define VM_GC_MIN_HEAP ((size_t) %d << 20)\n", this->gc_min_heap);
+    if (-1 == write_src_file (this, MEMORY_EXT))
+      return PARSEFILE_BREAK;
+    if (this->gc_mark_bitmap && -1 == write_src_file (this, MARKS_EXT))
+      return PARSEFILE_BREAK;
+    fprintf (this->fp_out, "/*** MEMORY EXTENSIONS END ***/\n");
+    return PARSEFILE_OK;
+  }
+
   if (strstr (file, "vm.c")) {
+    if (this->opcode_hooks != 3) {
+      fprintf (stderr, "%s of the upstream sources was not found\n",
+          (this->opcode_hooks & 1) ? "the loop of run()" : "endCompiler()");
+      return PARSEFILE_BREAK;
+    }
+
     fprintf (this->fp_out,
         "\n/*** EXTENSIONS ***/\n\n"
         "Table *vm_get_globals(DictuVM *vm) {\n"
@@ -932,8 +2291,19 @@ int file_on_close_cb (lang_t *this, char *file) {
         "    UNUSED(vm);\n"
         "    if (false == tableGet(table, obj, value))\n"
         "        return NULL;\n"
-        "    return value;\n}\n\n"
-        "/*** EXTENSIONS END ***/\n");
+        "    return value;\n}\n\n");
+
+    if (-1 == write_gc_stats (this))
+      return PARSEFILE_BREAK;
+
+    if (this->lazy_natives)
+      write_lazy_methods (this);
+
+    for (size_t i = 0; i < ARRLEN(ext_files); i++)
+      if (-1 == write_src_file (this, ext_files[i]))
+        return PARSEFILE_BREAK;
+
+    fprintf (this->fp_out, "/*** EXTENSIONS END ***/\n");
     return PARSEFILE_OK;
   }
 
@@ -1000,9 +2370,12 @@ int write_files (lang_t *this, char **files, size_t arrlen) {
     }
 
 next_file:
-    this->on_close_cb (this, file);
-
     fclose (fp);
+
+    if (PARSEFILE_BREAK == this->on_close_cb (this, file)) {
+      free (line);
+      return -1;
+    }
   }
 
   free (line);
@@ -1057,7 +2430,9 @@ int create_hfile (lang_t *this) {
       "typedef enum {\n"
         "INTERPRET_OK,\n"
         "INTERPRET_COMPILE_ERROR,\n"
-        "INTERPRET_RUNTIME_ERROR\n"
+        "INTERPRET_RUNTIME_ERROR,\n"
+        "INTERPRET_MEMORY_ERROR,\n"
+        "INTERPRET_YIELD\n"
       "} DictuInterpretResult;\n");
 
   this->exttype = H_TYPE;
@@ -1153,6 +2528,8 @@ int copy_files (lang_t *this) {
       this->lang_name, VERSION);
 
   fprintf (mfp, "ENABLE_REPL := %d\n", this->enable_repl);
+  fprintf (mfp, "ENABLE_PROFILER := %d\n", this->enable_profiler);
+  fprintf (mfp, "ENABLE_OPSTATS := %d\n", this->enable_opstats);
   fprintf (mfp, "ENABLE_HTTP := %d\n", this->enable_http);
   if (this->enable_sqlite == 0)
     fprintf (mfp, "DISABLE_SQLITE := $(shell ldconfig -v 2>/dev/null | grep sqlite3 >/dev/null; echo $$?)\n");
@@ -1160,6 +2537,7 @@ int copy_files (lang_t *this) {
     fprintf (mfp, "DISABLE_SQLITE := 0\n");
 
   fprintf (mfp, "\nSYSDIR  := sys\n");
+  fprintf (mfp, "BENCHDIR := %s/bench\n", this->src_dir);
 
   fclose (mfp);
 
@@ -1178,6 +2556,24 @@ int copy_files (lang_t *this) {
   if (-1 == copy_file (opc_file_src, opc_file_dest, NO_APPEND))
     return -1;
 
+  if (0 == this->has_nops || this->num_fused) {
+    FILE *ofp = fopen (opc_file_dest, "a");
+    if (NULL == ofp) {
+      fprintf (stderr, "fopen(): %s\n%s\n", opc_file_dest, strerror (errno));
+      return -1;
+    }
+
+    if (0 == this->has_nops)
+      fprintf (ofp, "\n// the filler of the optimizer (lmake)\nOPCODE(NOPS)\n");
+
+    if (this->num_fused)
+      fprintf (ofp, "\n// superinstructions (lmake --fuse)\n");
+    for (int i = 0; i < this->num_fused; i++)
+      fprintf (ofp, "OPCODE(%s)\n", this->fused[i].name);
+
+    fclose (ofp);
+  }
+
   size_t lineno_len = bytelen ("cli/linenoise.h");
   char lineno_file_src[this->lang_c_dir_len + lineno_len + 2];
   snprintf (lineno_file_src, this->lang_c_dir_len + lineno_len + 2, "%s/cli/linenoise.h", this->lang_c_dir);
@@ -1254,6 +2650,8 @@ int copy_files (lang_t *this) {
 
   fprintf (fp, "%s\n", main_headers);
   fprintf (fp, "#include <%s.h>\n", this->lang_name);
+  if (this->enable_lai)
+    fprintf (fp, "\n#define LAI_DIALECT\n");
   fclose (fp);
   if (-1 == copy_file (main_file_src, main_file_dest, APPEND))
     return -1;
@@ -1403,7 +2801,7 @@ int make (lang_t *this) {
   }
 
   if (this->build_interp) {
-    status = system (MAKE_INTERP);
+    status = system (this->enable_pgo ? MAKE_INTERP_PGO : MAKE_INTERP);
 
     if (WIFEXITED (status))
       retval = WEXITSTATUS (status);
@@ -1415,8 +2813,85 @@ theend:
   return retval;
 }
 
+/* the lai words, as the lai scanner takes them, and their Dictu text; a
+ * forever is followed by a do, that opens the body */
+static const char *lai_words[][2] = {
+  {"beg", "{"}, {"do", "{"}, {"then", "{"}, {"end", "}"},
+  {"is", "=="}, {"isnot", "!="}, {"not", "!"},
+  {"orelse", "} else"}, {"forever", "while (true)"}
+};
+
+/* copies a string literal with its quotes, so no word in it is translated */
+const char *lai_copy_string (FILE *fp, const char *sp, int escapes) {
+  char quote = *sp;
+  const char *end = sp + 1;
+
+  while (*end && *end != quote) {
+    if (escapes && *end == '\\' && end[1])
+      end++;
+    end++;
+  }
+
+  if (*end)
+    end++;
+
+  fwrite (sp, 1, end - sp, fp);
+  return end;
+}
+
+/* translates token by token, as the lai scanner reads the script: strings,
+ * raw strings and comments are copied as they are */
+void lai_translate (FILE *fp, const char *src) {
+  const char *sp = src;
+
+  while (*sp) {
+    const char *end = sp + 1;
+
+    if (sp[0] == '/' && sp[1] == '/') {
+      end = strchr (sp, '\n');
+      if (NULL == end)
+        end = sp + bytelen (sp);
+    } else if (sp[0] == '/' && sp[1] == '*') {
+      end = strstr (sp + 2, "*/");
+      end = NULL == end ? sp + bytelen (sp) : end + 2;
+    } else if (*sp == '"' || *sp == '\'') {
+      sp = lai_copy_string (fp, sp, 1);
+      continue;
+    } else if (*sp >= '0' && *sp <= '9') {
+      while (IS_IDENT_CHAR (*end) || (*end == '.' && end[1] >= '0' && end[1] <= '9'))
+        end++;
+    } else if (IS_IDENT_CHAR (*sp)) {
+      while (IS_IDENT_CHAR (*end))
+        end++;
+
+      if (end - sp == 1 && *sp == 'r' && (*end == '"' || *end == '\'')) {
+        fputc ('r', fp);
+        sp = lai_copy_string (fp, end, 0);
+        continue;
+      }
+
+      size_t i = 0;
+      for (; i < ARRLEN (lai_words); i++)
+        if ((size_t) (end - sp) == bytelen (lai_words[i][0]) &&
+            str_eq_n (sp, lai_words[i][0], end - sp))
+          break;
+
+      if (i < ARRLEN (lai_words)) {
+        fprintf (fp, "%s", lai_words[i][1]);
+        sp = end;
+        continue;
+      }
+    }
+
+    fwrite (sp, 1, end - sp, fp);
+    sp = end;
+  }
+}
+
+/* writes the script as a Dictu script next to it, with a .du extension */
 int parse_lai (char *laiscript, size_t scr_len) {
-  if (0 != access (laiscript, R_OK|F_OK)) {
+  struct stat st;
+  if (-1 == stat (laiscript, &st) || 0 != access (laiscript, R_OK)) {
     fprintf (stderr, "access(): %s\n%s\n", laiscript, strerror (errno));
     return -1;
   }
@@ -1439,16 +2914,24 @@ int parse_lai (char *laiscript, size_t scr_len) {
   free (dname);
 
   int retval = 0;
-  FILE *src_fp = NULL;
+  char *src = NULL;
   FILE *dest_fp = NULL;
 
-  src_fp = fopen (laiscript, "r");
+  FILE *src_fp = fopen (laiscript, "r");
   if (NULL == src_fp) {
     fprintf (stderr, "fopen(): %s\n%s\n", laiscript, strerror (errno));
+    return -1;
+  }
+
+  src = Alloc (st.st_size + 1);
+  if ((size_t) st.st_size != fread (src, 1, st.st_size, src_fp)) {
+    fprintf (stderr, "fread(): %s: couldn't read the requested bytes\n", laiscript);
     retval = -1;
     goto theend;
   }
 
+  src[st.st_size] = '\0';
+
   dest_fp = fopen (dict_file, "w");
   if (NULL == dest_fp) {
     fprintf (stderr, "fopen(): %s\n%s\n", dict_file, strerror (errno));
@@ -1456,192 +2939,16 @@ int parse_lai (char *laiscript, size_t scr_len) {
     goto theend;
   }
 
-  size_t lline_len = 256;
-  char *lline = Alloc (lline_len);
-
-  len = 0;
-  char *line = NULL;
-
-  ssize_t nread;
-  while (-1 != (nread = getline (&line, &len, src_fp))) {
-    if (nread) {
-      if (len + 32 > lline_len) {
-        lline_len = len + 32 + 1;
-        lline = Realloc (lline, lline_len);
-      }
-
-      char *match;
-      char tmp[lline_len];
-      size_t tmp_len;
-
-      ptrdiff_t diff = 0;
-      ptrdiff_t ldiff = 0;
-
-      tmp_len = str_cp (lline, lline_len, line, nread);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len);
-
-      while ((match = strstr (tmp + diff, " is "))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 4;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '=';
-        lline[++ldiff] = '=';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, " isnot "))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 7;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '!';
-        lline[++ldiff] = '=';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, "orelse "))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 7;
-        lline[ldiff]   = '}';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = 'e';
-        lline[++ldiff] = 'l';
-        lline[++ldiff] = 's';
-        lline[++ldiff] = 'e';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, "forever do"))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 10;
-        lline[ldiff]   = 'w';
-        lline[++ldiff] = 'h';
-        lline[++ldiff] = 'i';
-        lline[++ldiff] = 'l';
-        lline[++ldiff] = 'e';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '(';
-        lline[++ldiff] = 't';
-        lline[++ldiff] = 'r';
-        lline[++ldiff] = 'u';
-        lline[++ldiff] = 'e';
-        lline[++ldiff] = ')';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '{';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, " beg "))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 5;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '{';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, " then "))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 6;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '{';
-        lline[++ldiff] = ' ';
-        lline[++ldiff] = '\0';
-      }
-
-      tmp_len = str_cp (lline + ldiff, lline_len, tmp + diff, tmp_len - diff);
-      tmp_len = str_cp (tmp, lline_len, lline, tmp_len + ldiff);
-
-      diff = ldiff = 0;
-      while ((match = strstr (tmp + diff, " then\n"))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 6;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '{';
-        lline[++ldiff] = '\n';
-        lline[++ldiff] = '\0';
-        goto print;
-      }
-
-      while ((match = strstr (tmp + diff, " do\n"))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 4;
-        lline[ldiff] = ' ';
-        lline[++ldiff] = '{';
-        lline[++ldiff] = '\n';
-        lline[++ldiff] = '\0';
-        goto print;
-      }
-
-      while ((match = strstr (tmp + diff, "end\n"))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 4;
-        lline[ldiff] = '}';
-        lline[++ldiff] = '\n';
-        lline[++ldiff] = '\0';
-        goto print;
-      }
-
-      while ((match = strstr (tmp + diff, "beg\n"))) {
-        ldiff = match - tmp;
-        str_cp (lline + diff, lline_len, tmp, ldiff);
-        diff = ldiff + 4;
-        lline[ldiff] = '{';
-        lline[++ldiff] = '\n';
-        lline[++ldiff] = '\0';
-        goto print;
-      }
-
-      str_cp (lline + ldiff, lline_len, tmp + diff, bytelen (tmp) - diff);
-      str_cp (tmp, lline_len, lline, bytelen (lline));
-
-print:
-      fprintf (dest_fp, "%s", lline);
-
-    }
-  }
-
+  lai_translate (dest_fp, src);
 
 theend:
-  if (line != NULL)
-    free (line);
-
-  if (NULL != src_fp)
-    fclose (src_fp);
+  free (src);
+  fclose (src_fp);
 
-  if (NULL != dest_fp)
-    fclose (dest_fp);
+  if (NULL != dest_fp && 0 != fclose (dest_fp)) {
+    fprintf (stderr, "fclose(): %s\n%s\n", dict_file, strerror (errno));
+    retval = -1;
+  }
 
   return retval;
 }
@@ -1670,11 +2977,28 @@ int show_help (char *prog) {
      "                        run without any modification, otherwise is a bug\n"
      "  --disable-exit      # disables exit() method from System Class.\n"
      "                        This is off by default, enabled with --enable-lai implicitly\n"
+     "  --lazy-natives      # declare the datatype methods on their first use,\n"
+     "                        instead of at vm initialization\n"
+     "  --gc-mark-bitmap    # keep the marks of the collector outside of the objects\n"
+     "  --gc-grow-factor=`n'\n"
+     "                      # the heap grows by n after a collection, default [2]\n"
+     "  --gc-min-heap=`mb'  # no collection runs below mb megabytes, default [1]\n"
+     "  --enable-profiler   # build a sampling profiler into the library, that the\n"
+     "                        interpreter enables with --profile=`file'\n"
+     "  --enable-opstats    # build a library that counts the executed opcodes and\n"
+     "                        opcode pairs, and reports them when a vm is freed\n"
+     "  --enable-pgo        # with --build-interp, build a profile guided library and\n"
+     "                        interpreter, trained on the src/bench workloads (gcc)\n"
+     "  --fuse=`op,op[,..]' # fuse an opcode sequence, like GET_LOCAL,GET_LOCAL,ADD, into a\n"
+     "                        superinstruction, that the compiler emits (can be given many times)\n"
+     "  --fuse-file=`file'  # fuse the sequences of file, one per line, as the pairs of the\n"
+     "                        --enable-opstats report\n"
      "  --parse-lai         # parse lai script and output a Dictu script with a .du extension.\n"
      "                        Note: When this option is encountered, it stops to parsing thargv list\n"
      "                        and any subsequent argunent is treated as argument to this\n"
      "                        function, which after its execution the program exits.\n"
-     "                        This is a crude algorithm\n"
+     "                        The words are translated as the lai scanner reads them,\n"
+     "                        but in strings and comments\n"
      "  --sysdir=`dir'      # system directory with write access, default [../sys]\n"
      "  --builddir=`dir'    # build directory, default [build/dictu] or [build/lai]\n"
      "  --langcdir=`dir'    # Dictu c sources directory, defualt [src/Dictu]\n"
@@ -1706,11 +3030,61 @@ int parse_args (lang_t *this, int argc, char **argv) {
     }
 */
 
+    if (str_eq (argv[i], "--enable-profiler")) {
+      this->enable_profiler = 1;
+      continue;
+    }
+
+    if (str_eq (argv[i], "--enable-opstats")) {
+      this->enable_opstats = 1;
+      continue;
+    }
+
+    if (str_eq (argv[i], "--enable-pgo")) {
+      this->enable_pgo = 1;
+      continue;
+    }
+
     if (str_eq (argv[i], "--disable-exit")) {
       this->disable_exit = 1;
       continue;
     }
 
+    if (str_eq (argv[i], "--lazy-natives")) {
+      this->lazy_natives = 1;
+      continue;
+    }
+
+    if (str_eq (argv[i], "--gc-mark-bitmap")) {
+      this->gc_mark_bitmap = 1;
+      continue;
+    }
+
+    if (str_eq_n (argv[i], "--gc-grow-factor=", 17)) {
+      char *end;
+      double factor = strtod (argv[i] + 17, &end);
+      if (end == argv[i] + 17 || *end != '\0' || !isfinite (factor) || factor <= 1.0) {
+        fprintf (stderr, "%s: expected a number greater than 1\n", argv[i]);
+        return -1;
+      }
+
+      this->gc_grow_factor = factor;
+      continue;
+    }
+
+    if (str_eq_n (argv[i], "--gc-min-heap=", 14)) {
+      char *end;
+      errno = 0;
+      long mb = strtol (argv[i] + 14, &end, 10);
+      if (end == argv[i] + 14 || *end != '\0' || errno != 0 || mb <= 0 || mb > 1 << 20) {
+        fprintf (stderr, "%s: expected megabytes\n", argv[i]);
+        return -1;
+      }
+
+      this->gc_min_heap = (int) mb;
+      continue;
+    }
+
     if (str_eq (argv[i], "--enable-lai")) {
       this->api_len = this->lai_api_len;
       this->enable_lai = 1;
@@ -1811,6 +3185,24 @@ int parse_args (lang_t *this, int argc, char **argv) {
       continue;
     }
 
+    if (str_eq_n (argv[i], "--fuse=", 7)) {
+      int retval = add_fused (this, argv[i] + 7);
+      if (retval == -1)
+        return -1;
+
+      if (retval == 0) {
+        fprintf (stderr, "%s: expected two or more opcodes\n", argv[i]);
+        return -1;
+      }
+      continue;
+    }
+
+    if (str_eq_n (argv[i], "--fuse-file=", 12)) {
+      if (-1 == read_fuse_file (this, argv[i] + 12))
+        return -1;
+      continue;
+    }
+
     if (str_eq (argv[i], "--parse-lai")) {
       this->lai_to_dictu = 1;
       this->arg_idx = i + 1;
@@ -1904,17 +3296,43 @@ void deinit_this (lang_t *this) {
 
   if (this->lang_name)
     free (this->lang_name);
+
+  for (int i = 0; i < this->num_case_bodies; i++)
+    free (this->case_bodies[i].body);
 }
 
 lang_t init_this (int argc, char **argv) {
   lang_t this;
   this.enable_http = 0;
   this.enable_repl = 1;
+  this.enable_profiler = 0;
+  this.enable_opstats = 0;
+  this.enable_pgo = 0;
   this.enable_sqlite = 0;
   this.enable_lai  = 0;
   this.disable_exit = 0;
+  this.lazy_natives = 0;
+  this.gc_mark_bitmap = 0;
+  this.gc_min_heap = 0;
+  this.gc_grow_factor = 0;
+  this.num_lazy_methods = 0;
+  this.num_obj_types = 0;
   this.help = 0;
   this.skip_function = 0;
+  this.in_string_struct = 0;
+  this.in_vm_struct = 0;
+  this.in_init_vm = 0;
+  this.in_safepoint_case = 0;
+  this.in_run_loop = 0;
+  this.in_end_compiler = 0;
+  this.opcode_hooks = 0;
+  this.num_fused = 0;
+  this.num_opcodes = 0;
+  this.has_nops = 0;
+  this.num_case_bodies = 0;
+  this.case_body = NULL;
+  this.num_native_tables = 0;
+  this.skip_reallocate = 0;
   this.build_library = 0;
   this.build_interp  = 0;
   this.clean_build   = 0;
@@ -1996,6 +3414,14 @@ int run (lang_t *this, char *prog) {
   if (this->help)
     return show_help (prog);
 
+  if (-1 == read_opcodes (this))
+    return 1;
+
+  this->has_nops = is_opcode (this, "NOPS");
+
+  if (this->num_fused && -1 == check_fused (this))
+    return 1;
+
   if (-1 == create_cfile (this))
     return 1;
 
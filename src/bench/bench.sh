@@ -0,0 +1,103 @@
+#!/bin/sh
+# Runs every workload of the directories n times against an interpreter, prints
+# the median and the median absolute deviation of the wall time of each, and
+# writes the same as JSON, that compare.sh can diff against another run.
+#
+# usage: bench.sh [-n runs] [-o file.json] [-l label] [-x "du lai"] interpreter dir...
+
+runs=10
+out=bench.json
+label=
+exts=du
+
+while getopts n:o:l:x: opt; do
+  case $opt in
+    n) runs=$OPTARG ;;
+    o) out=$OPTARG ;;
+    l) label=$OPTARG ;;
+    x) exts=$OPTARG ;;
+    *) exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 [-n runs] [-o file.json] [-l label] [-x \"du lai\"] interpreter dir..." >&2
+  exit 2
+fi
+
+interp=$1
+shift
+
+if [ ! -x "$interp" ]; then
+  echo "$interp: not an executable, build the interpreter first" >&2
+  exit 1
+fi
+
+[ -n "$label" ] || label=$(basename "$interp")
+commit=$(git -C "$1" rev-parse --short HEAD 2>/dev/null)
+times=$(mktemp) || exit 1
+trap 'rm -f "$times"' EXIT
+
+# median and MAD in milliseconds of the nanosecond samples, one per line
+stats () {
+  sort -n "$times" | awk '
+    { t[NR] = $1 / 1e6 }
+    END {
+      m = (NR % 2) ? t[(NR + 1) / 2] : (t[NR / 2] + t[NR / 2 + 1]) / 2
+      for (i = 1; i <= NR; i++) d[i] = (t[i] > m) ? t[i] - m : m - t[i]
+      for (i = 2; i <= NR; i++)
+        for (j = i; j > 1 && d[j - 1] > d[j]; j--) { x = d[j]; d[j] = d[j - 1]; d[j - 1] = x }
+      mad = (NR % 2) ? d[(NR + 1) / 2] : (d[NR / 2] + d[NR / 2 + 1]) / 2
+      printf "%.3f %.3f %.3f %.3f\n", m, mad, t[1], t[NR]
+    }'
+}
+
+status=0
+sep=
+
+{
+  printf '{\n  "label": "%s",\n  "commit": "%s",\n  "interpreter": "%s",\n  "runs": %d,\n  "results": [' \
+      "$label" "$commit" "$interp" "$runs"
+} > "$out"
+
+printf '%-24s %12s %10s %12s %12s\n' workload median_ms mad_ms min_ms max_ms
+
+for dir in "$@"; do
+  for ext in $exts; do
+    for script in "$dir"/*."$ext"; do
+      [ -f "$script" ] || continue
+      name=$(basename "$script")
+      : > "$times"
+      failed=0
+      i=0
+
+      while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        if ! "$interp" "$script" > /dev/null; then
+          failed=1
+          break
+        fi
+        end=$(date +%s%N)
+        echo $((end - start)) >> "$times"
+        i=$((i + 1))
+      done
+
+      if [ $failed -eq 1 ]; then
+        printf '%-24s failed\n' "$name"
+        status=1
+        continue
+      fi
+
+      set -- $(stats)
+      printf '%-24s %12s %10s %12s %12s\n' "$name" "$1" "$2" "$3" "$4"
+      printf '%s\n    {"name": "%s", "median_ms": %s, "mad_ms": %s, "min_ms": %s, "max_ms": %s}' \
+          "$sep" "$name" "$1" "$2" "$3" "$4" >> "$out"
+      sep=,
+    done
+  done
+done
+
+printf '\n  ]\n}\n' >> "$out"
+echo "wrote $out"
+exit $status
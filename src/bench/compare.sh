@@ -0,0 +1,46 @@
+#!/bin/sh
+# Compares two bench.sh JSON files, a baseline and a candidate, and prints the
+# median of each workload they have in common, with the candidate/baseline
+# ratio and whether the difference exceeds the sum of the two MADs.
+#
+# usage: compare.sh baseline.json candidate.json
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 baseline.json candidate.json" >&2
+  exit 2
+fi
+
+awk '
+  function field(line, key,    s) {
+    s = line
+    sub(".*\"" key "\": *", "", s)
+    sub("[,}].*", "", s)
+    gsub("\"", "", s)
+    return s
+  }
+
+  /"label"/ { label[FILENAME == ARGV[1]] = field($0, "label") }
+
+  /"median_ms"/ {
+    name = field($0, "name")
+    if (FILENAME == ARGV[1]) {
+      base[name] = field($0, "median_ms")
+      bmad[name] = field($0, "mad_ms")
+      order[++n] = name
+    } else {
+      cand[name] = field($0, "median_ms")
+      cmad[name] = field($0, "mad_ms")
+    }
+  }
+
+  END {
+    printf "%-24s %12s %12s %8s\n", "workload", label[1], label[0], "ratio"
+    for (i = 1; i <= n; i++) {
+      name = order[i]
+      if (!(name in cand) || base[name] == 0)
+        continue
+      diff = cand[name] - base[name]
+      note = ((diff > 0 ? diff : -diff) > bmad[name] + cmad[name]) ? (diff > 0 ? "slower" : "faster") : ""
+      printf "%-24s %12.3f %12.3f %8.3f %s\n", name, base[name], cand[name], cand[name] / base[name], note
+    }
+  }' "$1" "$2"
@@ -6,13 +6,45 @@ typedef struct _vm DictuVM;
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_MEMORY_ERROR,
+    INTERPRET_YIELD
 } DictuInterpretResult;
 
 DictuVM *dictuInitVM(bool repl, int argc, char *argv[]);
 
+/* a NULL realloc/free is libc; with discardHeap, dictuFreeVM() drops the
+ * heap with release() instead of freeing every object */
+typedef struct {
+    void *(*realloc)(void *data, void *ptr, size_t oldSize, size_t newSize);
+    void (*free)(void *data, void *ptr, size_t oldSize);
+    void (*release)(void *data);
+    void *data;
+    bool discardHeap;
+} DictuAllocator;
+
+DictuVM *dictuInitVMWithAllocator(bool repl, int argc, char *argv[], DictuAllocator *allocator);
+
 void dictuFreeVM(DictuVM *vm);
 
+/* drops user globals, modules and their objects, but keeps the natives and
+ * the last snapshot; the objects of the snapshot are shared, not copied, so
+ * changes a script makes to them are seen by the next one */
+void dictuResetVM(DictuVM *vm);
+
+/* the current globals and modules become the state dictuResetVM() restores */
+void dictuSnapshotVM(DictuVM *vm);
+
+/* interprets source, publishes the variables that its __exports__ list names
+ * as read only globals, then snapshots */
+DictuInterpretResult dictuInterpretPrelude(DictuVM *vm, char *moduleName, char *source);
+
+/* System.argv for the next script a reused vm runs, argv[1] is the script */
+void dictuSetArgv(DictuVM *vm, int argc, char *argv[]);
+
+/* hook gets the status of a System.exit(), right before the process exits */
+void vm_on_exit(DictuVM *vm, void (*hook)(DictuVM *vm, int status));
+
 DictuInterpretResult dictuInterpret(DictuVM *vm, char *moduleName, char *source);
 
 typedef uint64_t Value;
@@ -48,11 +80,15 @@ struct sObj {
     struct sObj *next;
 };
 
+typedef void (*ObjStringRelease)(void *data, char *chars, int length);
+
 struct sObjString {
     Obj obj;
     int length;
     char *chars;
     uint32_t hash;
+    ObjStringRelease release;
+    void *releaseData;
 };
 
 typedef struct {
@@ -234,6 +270,17 @@ typedef struct l_table_t {
   l_table_get_t get;
 } l_table_t;
 
+typedef struct l_list_t {
+  ObjList
+    *(*fromDoubles) (Lstate *, const double *, int),
+    *(*fromInt64)   (Lstate *, const int64_t *, int);
+
+  int
+    (*toDoubles) (ObjList *, double *, int),
+    (*toInt64)   (ObjList *, int64_t *, int);
+
+} l_list_t;
+
 typedef struct l_module_t {
   ObjModule *(*get) (Lstate *, char *, int len);
 } l_module_t;
@@ -241,18 +288,34 @@ typedef struct l_module_t {
 typedef struct l_t {
   l_table_t table;
   l_module_t module;
+  l_list_t list;
 
-  Lstate *(*init) (const char *, int, const char **);
+  Lstate
+    *(*init) (const char *, int, const char **),
+    *(*initWithAllocator) (const char *, int, const char **, DictuAllocator *);
 
   void
     (*deinit) (Lstate **),
+    (*reset) (Lstate *),
+    (*setArgv) (Lstate *, int, char **),
+    (*setOptLevel) (Lstate *, int),
+    (*profileStop) (Lstate *),
     (*defineProp) (Lstate *, Table *, const char *, Value),
     (*defineFun) (Lstate *, Table *, const char *, NativeFn);
 
   size_t (*vmsize) (void);
 
-  DictuInterpretResult (*compile) (Lstate *, char *, char *);
+  DictuInterpretResult
+    (*compile) (Lstate *, char *, char *),
+    (*prelude) (Lstate *, char *, char *);
+
+  void (*snapshot) (Lstate *);
+  bool (*profileStart) (Lstate *, int, const char *);
+  bool (*traceStart) (const char *, uint64_t);
   ObjString *(*newString) (Lstate *, const char *, int);
+  ObjString *(*newExternalString) (Lstate *, const char *, int, ObjStringRelease, void *);
+  ObjDict *(*newDict) (Lstate *, int);
+  ObjSet *(*newSet) (Lstate *, int);
 
 } l_t;
 
@@ -287,4 +350,94 @@ Table *vm_get_module_table(DictuVM *vm, char *name, int len);
 Value *vm_table_get_value(DictuVM *vm, Table *table, ObjString *obj, Value *value);
 Value strerrorNative(DictuVM *vm, int argCount, Value *args);
 size_t vm_sizeof (void);
+
+/* The chars are not copied; they must stay valid and be '\0' terminated at
+ * length, until release is called (a NULL release means static memory) */
+ObjString *vm_string_external(DictuVM *vm, const char *chars, int length,
+        ObjStringRelease release, void *releaseData);
+
+/* bulk marshalling; a C double[] is copied with a single memcpy, a count of
+ * 0 or less is an empty list (or nothing copied) */
+ObjList *vm_list_from_doubles(DictuVM *vm, const double *array, int count);
+ObjList *vm_list_from_int64(DictuVM *vm, const int64_t *array, int count);
+int vm_list_to_doubles(ObjList *list, double *array, int count);
+int vm_list_to_int64(ObjList *list, int64_t *array, int count);
+ObjDict *vm_dict_new_sized(DictuVM *vm, int capacity);
+ObjSet *vm_set_new_sized(DictuVM *vm, int capacity);
+
+/* a bump arena for short lived vms; blockSize 0 means 1MB blocks */
+bool vm_arena_allocator(DictuAllocator *allocator, size_t blockSize);
+void vm_arena_reset(DictuAllocator *allocator);
+
+/* collector tuning: these set when the single, non generational mark-sweep
+ * of memory.c runs, each collection still walks the whole heap */
+
+/* the next collection runs after bytes more are allocated */
+void vm_gc_defer(DictuVM *vm, size_t bytes);
+
+/* the heap grows by growFactor after a collection, but never collects below
+ * minHeap bytes; 0 keeps the current value */
+void vm_gc_tune(DictuVM *vm, double growFactor, size_t minHeap);
+
+/* collection pauses; buckets[i] counts the pauses under 2^i microseconds,
+ * the last bucket the longer ones. A pause is the whole collection, mark and
+ * sweep, stopped the world on the thread that allocated */
+#define VM_GC_PAUSE_BUCKETS 24
+
+typedef struct {
+    uint64_t collections;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[VM_GC_PAUSE_BUCKETS];
+} DictuGCPauses;
+
+const DictuGCPauses *vm_gc_pauses(DictuVM *vm);
+void vm_gc_pauses_reset(DictuVM *vm);
+
+/* allocation and collection counters, cheap enough to be always on; the
+ * objects[] are indexed by ObjType, vm_gc_obj_type_name() names them */
+#define VM_GC_OBJ_TYPES 32
+
+typedef struct {
+    uint64_t bytesAllocated;
+    uint64_t bytesFreed;
+    uint64_t liveBytes;
+    uint64_t collections;
+    uint64_t totalPauseNs;
+    uint64_t maxPauseNs;
+    uint64_t objects[VM_GC_OBJ_TYPES];
+} DictuGCStats;
+
+void vm_gc_stats(DictuVM *vm, DictuGCStats *stats);
+const char *vm_gc_obj_type_name(int type);
+
+/* scripts that grow the heap past bytes, even after a collection, end with
+ * INTERPRET_MEMORY_ERROR at their next backward jump or call; 0 is no limit */
+void vm_heap_limit(DictuVM *vm, size_t bytes);
+
+/* a script yields INTERPRET_YIELD after ticks backward jumps and calls, or
+ * at the first of them after ns nanoseconds, counted from the start of each
+ * dictuInterpret() or dictuResume(); 0 disables either */
+void vm_time_slice(DictuVM *vm, uint64_t ticks, uint64_t ns);
+
+/* the functions compiled after it are optimized at level 0 (none, the
+ * default), 1 (constant folding and jump threading) or 2 (also the pushes
+ * that are popped right away and the code after a return) */
+void vm_set_opt_level(DictuVM *vm, int level);
+
+/* continues a script that yielded, for another time slice */
+DictuInterpretResult dictuResume(DictuVM *vm);
+
+/* with lmake --enable-profiler, samples the script frames hz times per cpu
+ * second, in collapsed stack lines; vm_profiler_stop(), dictuFreeVM() and
+ * vm_exit() write them to path, vm_profiler_write() at any time */
+bool vm_profiler_start(DictuVM *vm, int hz, const char *path);
+void vm_profiler_stop(DictuVM *vm);
+bool vm_profiler_write(DictuVM *vm, const char *path);
+
+/* Chrome trace events of all the vms to path, with the native calls that
+ * take nativeThresholdNs or more; a vm also starts it, when created with
+ * DICTU_TRACE=path (and DICTU_TRACE_NATIVE_US=us, 100 by default) */
+bool vm_trace_start(const char *path, uint64_t nativeThresholdNs);
+void vm_trace_stop(void);
 #endif /* LAPI */
@@ -0,0 +1,128 @@
+/* a bump arena allocator, for short lived virtual machines */
+
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(size) (((size) + (ARENA_ALIGN - 1)) & ~((size_t) ARENA_ALIGN - 1))
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    size_t blockSize;
+    void *last;
+} Arena;
+
+static ArenaBlock *arenaNewBlock(Arena *arena, size_t size) {
+    if (size < arena->blockSize)
+        size = arena->blockSize;
+
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL)
+        return NULL;
+
+    block->size = size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+    return block;
+}
+
+static void *arenaRealloc(void *data, void *ptr, size_t oldSize, size_t newSize) {
+    Arena *arena = data;
+    ArenaBlock *block = arena->head;
+
+    // the last allocation grows or shrinks in place
+    if (ptr != NULL && ptr == arena->last) {
+        size_t offset = (char *) ptr - block->data;
+        if (offset + newSize <= block->size) {
+            block->used = offset + ARENA_ALIGN_UP(newSize);
+            return ptr;
+        }
+    }
+
+    if (ptr != NULL && newSize <= oldSize)
+        return ptr;
+
+    size_t size = ARENA_ALIGN_UP(newSize);
+    if (block == NULL || block->used + size > block->size)
+        if (NULL == (block = arenaNewBlock(arena, size)))
+            return NULL;
+
+    void *mem = block->data + block->used;
+    block->used += size;
+    arena->last = mem;
+
+    if (ptr != NULL)
+        memcpy(mem, ptr, oldSize);
+
+    return mem;
+}
+
+static void arenaFree(void *data, void *ptr, size_t oldSize) {
+    UNUSED(oldSize);
+    Arena *arena = data;
+
+    // only the last allocation is reclaimed, the rest goes with the arena
+    if (ptr != NULL && ptr == arena->last) {
+        arena->head->used = (char *) ptr - arena->head->data;
+        arena->last = NULL;
+    }
+}
+
+static void arenaRelease(void *data) {
+    Arena *arena = data;
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+void vm_arena_reset(DictuAllocator *allocator) {
+    Arena *arena = allocator->data;
+    ArenaBlock *block = arena->head;
+    if (block == NULL)
+        return;
+
+    while (block->next != NULL) {
+        ArenaBlock *next = block->next;
+        block->next = next->next;
+        free(next);
+    }
+
+    block->used = 0;
+    arena->last = NULL;
+}
+
+bool vm_arena_allocator(DictuAllocator *allocator, size_t blockSize) {
+    Arena *arena = malloc(sizeof(Arena));
+    if (arena == NULL)
+        return false;
+
+    arena->head = NULL;
+    arena->last = NULL;
+    arena->blockSize = blockSize ? blockSize : 1 << 20;
+
+    allocator->realloc = arenaRealloc;
+    allocator->free = arenaFree;
+    allocator->release = arenaRelease;
+    allocator->data = arena;
+    allocator->discardHeap = true;
+    return true;
+}
+
+// called by dictuInitVMWithAllocator() on the zeroed vm; NULL keeps libc
+void vm_allocator_setup(DictuVM *vm, DictuAllocator *allocator) {
+    if (allocator != NULL)
+        vm->allocator = *allocator;
+}
+
+#undef ARENA_ALIGN_UP
+#undef ARENA_ALIGN
@@ -0,0 +1,124 @@
+/* bulk marshalling between C arrays and Dictu containers */
+
+_Static_assert(sizeof(double) == sizeof(Value), "Value is not NaN boxed");
+
+// a NaN whose payload collides with the tag bits would be read back as a
+// nil/bool/object, so such doubles are replaced by the canonical NaN
+static inline Value canonicalNumber(Value value) {
+    if ((value & QNAN) == QNAN)
+        return numToValue(NAN);
+
+    return value;
+}
+
+static void listReserve(DictuVM *vm, ObjList *list, int count) {
+    if (list->values.capacity >= count)
+        return;
+
+    list->values.values = GROW_ARRAY(vm, list->values.values, Value,
+            list->values.capacity, count);
+    list->values.capacity = count;
+}
+
+// the smallest power of two mask, that holds count items under the max load
+static int capacityMaskFor(int count, double maxLoad) {
+    int capacity = 8;
+    while (capacity * maxLoad < count)
+        capacity *= 2;
+
+    return capacity - 1;
+}
+
+// a count of 0 or less is an empty list, array isn't read then
+ObjList *vm_list_from_doubles(DictuVM *vm, const double *array, int count) {
+    ObjList *list = newList(vm);
+    if (count <= 0)
+        return list;
+
+    push(vm, OBJ_VAL(list));
+    listReserve(vm, list, count);
+
+    Value *values = list->values.values;
+    memcpy(values, array, sizeof(double) * (size_t) count);
+    for (int i = 0; i < count; i++)
+        values[i] = canonicalNumber(values[i]);
+
+    list->values.count = count;
+    pop(vm);
+    return list;
+}
+
+ObjList *vm_list_from_int64(DictuVM *vm, const int64_t *array, int count) {
+    ObjList *list = newList(vm);
+    if (count <= 0)
+        return list;
+
+    push(vm, OBJ_VAL(list));
+    listReserve(vm, list, count);
+
+    Value *values = list->values.values;
+    for (int i = 0; i < count; i++)
+        values[i] = NUMBER_VAL((double) array[i]);
+
+    list->values.count = count;
+    pop(vm);
+    return list;
+}
+
+// returns the number of copied elements, or -1 if the list holds a non number
+int vm_list_to_doubles(ObjList *list, double *array, int count) {
+    if (count > list->values.count)
+        count = list->values.count;
+
+    if (count <= 0)
+        return 0;
+
+    Value *values = list->values.values;
+    for (int i = 0; i < count; i++)
+        if (!IS_NUMBER(values[i]))
+            return -1;
+
+    memcpy(array, values, sizeof(double) * (size_t) count);
+    return count;
+}
+
+int vm_list_to_int64(ObjList *list, int64_t *array, int count) {
+    if (count > list->values.count)
+        count = list->values.count;
+
+    if (count <= 0)
+        return 0;
+
+    Value *values = list->values.values;
+    for (int i = 0; i < count; i++) {
+        if (!IS_NUMBER(values[i]))
+            return -1;
+
+        array[i] = (int64_t) AS_NUMBER(values[i]);
+    }
+
+    return count;
+}
+
+ObjDict *vm_dict_new_sized(DictuVM *vm, int capacity) {
+    ObjDict *dict = initDict(vm);
+    if (capacity <= 0)
+        return dict;
+
+    push(vm, OBJ_VAL(dict));
+    adjustDictCapacity(vm, dict, capacityMaskFor(capacity, DICT_MAX_LOAD));
+    pop(vm);
+    return dict;
+}
+
+ObjSet *vm_set_new_sized(DictuVM *vm, int capacity) {
+    ObjSet *set = initSet(vm);
+    if (capacity <= 0)
+        return set;
+
+    push(vm, OBJ_VAL(set));
+    adjustSetCapacity(vm, set, capacityMaskFor(capacity, SET_MAX_LOAD));
+    pop(vm);
+    return set;
+}
+
@@ -0,0 +1,109 @@
+// with lmake --gc-mark-bitmap, the marks of a collection are kept in a
+// bitmap per 4 KiB page of the heap, one bit per 8 bytes, instead of in
+// Obj.isDark; marking then writes only to the bitmaps, so the pages of the
+// heap stay clean (and shared after fork()). The bitmaps are found by page
+// address in an open addressing table, of about one entry per live page
+
+static size_t markSlot(MarkSet *marks, uintptr_t page) {
+    uint64_t hash = (uint64_t) page * UINT64_C(0x9E3779B97F4A7C15);
+    size_t slot = (size_t) (hash >> 32) & (marks->capacity - 1);
+
+    while (marks->pages[slot].page != 0 && marks->pages[slot].page != page)
+        slot = (slot + 1) & (marks->capacity - 1);
+
+    return slot;
+}
+
+// not through reallocate(), this memory isn't part of the heap
+static void markSetAlloc(MarkSet *marks, size_t capacity) {
+    marks->pages = calloc(capacity, sizeof(MarkPage));
+    if (marks->pages == NULL) {
+        printf("Unable to allocate memory\n");
+        exit(71);
+    }
+
+    marks->capacity = capacity;
+    marks->count = 0;
+}
+
+static void markSetGrow(MarkSet *marks) {
+    MarkPage *pages = marks->pages;
+    size_t oldCapacity = marks->capacity;
+
+    markSetAlloc(marks, oldCapacity < 64 ? 64 : oldCapacity * 2);
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (pages[i].page != 0) {
+            marks->pages[markSlot(marks, pages[i].page)] = pages[i];
+            marks->count++;
+        }
+    }
+
+    free(pages);
+}
+
+#define MARK_PAGE(object) ((uintptr_t) (object) >> VM_MARK_PAGE_SHIFT)
+#define MARK_BIT(object) \
+    (((uintptr_t) (object) & (((uintptr_t) 1 << VM_MARK_PAGE_SHIFT) - 1)) >> 3)
+
+bool vm_mark_test(DictuVM *vm, Obj *object) {
+    MarkSet *marks = &vm->marks;
+    if (!marks->marked)
+        return false;
+
+    MarkPage *page = &marks->pages[markSlot(marks, MARK_PAGE(object))];
+    if (page->page == 0)
+        return false;
+
+    size_t bit = MARK_BIT(object);
+    return (page->bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+void vm_mark_set(DictuVM *vm, Obj *object) {
+    MarkSet *marks = &vm->marks;
+    if ((marks->count + 1) * 2 > marks->capacity)
+        markSetGrow(marks);
+
+    MarkPage *page = &marks->pages[markSlot(marks, MARK_PAGE(object))];
+    if (page->page == 0) {
+        page->page = MARK_PAGE(object);
+        marks->count++;
+    }
+
+    size_t bit = MARK_BIT(object);
+    page->bits[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    marks->marked = true;
+}
+
+static bool markPageUsed(MarkPage *page) {
+    for (int i = 0; i < VM_MARK_PAGE_WORDS; i++)
+        if (page->bits[i] != 0)
+            return true;
+
+    return false;
+}
+
+// after the sweep, every survivor is white again; the pages with marks stay
+// in the table, with cleared bitmaps, as they likely have survivors next
+// time, and the others are dropped
+void vm_mark_clear(DictuVM *vm) {
+    MarkSet *marks = &vm->marks;
+    if (!marks->marked)
+        return;
+
+    MarkPage *pages = marks->pages;
+    size_t capacity = marks->capacity;
+
+    markSetAlloc(marks, capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        if (pages[i].page != 0 && markPageUsed(&pages[i])) {
+            marks->pages[markSlot(marks, pages[i].page)].page = pages[i].page;
+            marks->count++;
+        }
+    }
+
+    free(pages);
+    marks->marked = false;
+}
+
+#undef MARK_BIT
+#undef MARK_PAGE
@@ -0,0 +1,116 @@
+// objects that hold resources outside of the heap still have to be finalized,
+// and the gray stack, that the collector grows with libc, freed; with none
+// of those objects, the heap goes with the arena without a walk
+bool vm_allocator_discard(DictuVM *vm) {
+    if (vm->allocator.discardHeap == false)
+        return false;
+
+    for (Obj *object = vm->objects; object != NULL && vm->finalizers != 0;) {
+        Obj *next = object->next;
+        if (VM_OBJ_FINALIZED(object))
+            freeObject(vm, object);
+        object = next;
+    }
+
+    free(vm->grayStack);
+
+    DictuAllocator allocator = vm->allocator;
+    free(vm);
+    allocator.release(allocator.data);
+    return true;
+}
+
+// the next collection is due at the heap limit at the latest, while the heap
+// is under it; over it, the heap reason stops the script, and its error and
+// the hosts that go on using the vm collect at the usual growth, rather than
+// on every allocation
+static void gcLimit(DictuVM *vm) {
+    if (vm->heapLimit != 0 && vm->bytesAllocated < vm->heapLimit &&
+        vm->nextGC > vm->heapLimit)
+        vm->nextGC = vm->heapLimit;
+}
+
+// no collection runs until bytes more are allocated; a forked child that
+// serves a single request exits before it would have to mark the heap,
+// which would write to every live object and unshare its pages
+void vm_gc_defer(DictuVM *vm, size_t bytes) {
+    vm->nextGC = vm->bytesAllocated + bytes;
+    gcLimit(vm);
+}
+
+#ifndef VM_GC_GROW_FACTOR
+#define VM_GC_GROW_FACTOR GC_HEAP_GROW_FACTOR
+#endif
+
+#ifndef VM_GC_MIN_HEAP
+#define VM_GC_MIN_HEAP (1024 * 1024)
+#endif
+
+// lmake --gc-grow-factor= and --gc-min-heap= set the defaults; the snapshot
+// tables are roots, so they have to be valid before the first collection
+void vm_gc_setup(DictuVM *vm) {
+    vm->gcGrowFactor = VM_GC_GROW_FACTOR;
+    vm->gcMinHeap = VM_GC_MIN_HEAP;
+    initTable(&vm->baseGlobals);
+    initTable(&vm->baseModules);
+}
+
+void vm_gc_next(DictuVM *vm) {
+    size_t next = (size_t) ((double) vm->bytesAllocated * vm->gcGrowFactor);
+    vm->nextGC = next < vm->gcMinHeap ? vm->gcMinHeap : next;
+    gcLimit(vm);
+}
+
+// a larger minimum heap lets scripts that churn short lived objects run
+// without collecting, while the heap stays small
+void vm_gc_tune(DictuVM *vm, double growFactor, size_t minHeap) {
+    if (growFactor > 1.0)
+        vm->gcGrowFactor = growFactor;
+
+    if (minHeap > 0)
+        vm->gcMinHeap = minHeap;
+
+    vm_gc_next(vm);
+}
+
+uint64_t vm_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// a pause lands in the first bucket i, where it took less than 2^i us
+void vm_gc_pause(DictuVM *vm, uint64_t start, uint64_t sweepStart) {
+    DictuGCPauses *pauses = &vm->gcPauses;
+    uint64_t end = vm_clock_ns();
+    uint64_t ns = end - start;
+
+    if (vm_trace_file != NULL) {
+        if (sweepStart != 0) {
+            vm_trace_event("gc mark", "gc", start, sweepStart, NULL);
+            vm_trace_event("gc sweep", "gc", sweepStart, end, NULL);
+        } else {
+            vm_trace_event("gc", "gc", start, end, NULL);
+        }
+    }
+    uint64_t us = ns / 1000;
+
+    int bucket = 0;
+    while (bucket < VM_GC_PAUSE_BUCKETS - 1 && ((uint64_t) 1 << bucket) <= us)
+        bucket++;
+
+    pauses->collections++;
+    pauses->totalNs += ns;
+    if (ns > pauses->maxNs)
+        pauses->maxNs = ns;
+    pauses->buckets[bucket]++;
+}
+
+const DictuGCPauses *vm_gc_pauses(DictuVM *vm) {
+    return &vm->gcPauses;
+}
+
+void vm_gc_pauses_reset(DictuVM *vm) {
+    memset(&vm->gcPauses, 0, sizeof(DictuGCPauses));
+}
+
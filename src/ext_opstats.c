@@ -0,0 +1,111 @@
+#ifdef ENABLE_OPSTATS
+// every dispatch of run() goes through vm_opstat(), that counts the opcode
+// and the pair it forms with the previous one, and charges the time since
+// the previous dispatch to the previous opcode (so a CALL of a native is
+// charged the native); the counters are per process, for all the vms
+
+static const char *OpNames[] = {
+    #define OPCODE(name) #name,
+    #include "opcodes.h"
+    #undef OPCODE
+};
+
+#define OPSTATS_NUM_OPS   (int) (sizeof(OpNames) / sizeof(OpNames[0]))
+#define OPSTATS_NUM_PAIRS 40
+
+typedef struct {
+    uint64_t counts[256];
+    uint64_t ns[256];
+    uint64_t pairs[256][256];
+    uint64_t last;
+    int previous;
+} OpStats;
+
+static OpStats opStats = {.previous = -1};
+
+uint8_t vm_opstat(uint8_t op) {
+    uint64_t now = vm_clock_ns();
+
+    if (opStats.previous >= 0) {
+        opStats.ns[opStats.previous] += now - opStats.last;
+        opStats.pairs[opStats.previous][op]++;
+    }
+
+    opStats.counts[op]++;
+    opStats.previous = op;
+    opStats.last = now;
+    return op;
+}
+
+static int opStatsCompare(const void *a, const void *b) {
+    uint64_t ca = *(const uint64_t *) a, cb = *(const uint64_t *) b;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static const char *opStatsName(int op) {
+    return op < OPSTATS_NUM_OPS ? OpNames[op] : "?";
+}
+
+// each entry is the count, with the opcode (or pair) in the low 16 bits,
+// so a single sort orders them
+void vm_opstats_dump(FILE *fp) {
+    uint64_t total = 0;
+    uint64_t ops[256];
+    int numOps = 0;
+
+    for (int op = 0; op < 256; op++) {
+        total += opStats.counts[op];
+        if (opStats.counts[op] != 0)
+            ops[numOps++] = op;
+    }
+
+    if (total == 0)
+        return;
+
+    for (int i = 0; i < numOps; i++)
+        ops[i] |= opStats.counts[ops[i]] << 16;
+    qsort(ops, numOps, sizeof(uint64_t), opStatsCompare);
+
+    fprintf(fp, "%-24s %14s %7s %14s %9s\n", "opcode", "count", "%", "ns", "ns/op");
+    for (int i = 0; i < numOps; i++) {
+        int op = (int) (ops[i] & 0xffff);
+        fprintf(fp, "%-24s %14llu %6.2f%% %14llu %9.1f\n", opStatsName(op),
+                (unsigned long long) opStats.counts[op],
+                100.0 * (double) opStats.counts[op] / (double) total,
+                (unsigned long long) opStats.ns[op],
+                (double) opStats.ns[op] / (double) opStats.counts[op]);
+    }
+
+    uint64_t pairs[OPSTATS_NUM_PAIRS + 1];
+    int numPairs = 0;
+
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            uint64_t count = opStats.pairs[a][b];
+            if (count == 0)
+                continue;
+
+            if (numPairs == OPSTATS_NUM_PAIRS && count <= (pairs[numPairs - 1] >> 16))
+                continue;
+
+            if (numPairs < OPSTATS_NUM_PAIRS)
+                numPairs++;
+
+            pairs[numPairs - 1] = (count << 16) | (uint64_t) (a << 8 | b);
+            qsort(pairs, numPairs, sizeof(uint64_t), opStatsCompare);
+        }
+    }
+
+    fprintf(fp, "\n%-49s %14s %7s\n", "pair", "count", "%");
+    for (int i = 0; i < numPairs; i++) {
+        int a = (int) ((pairs[i] >> 8) & 0xff), b = (int) (pairs[i] & 0xff);
+        fprintf(fp, "%-24s %-24s %14llu %6.2f%%\n", opStatsName(a), opStatsName(b),
+                (unsigned long long) (pairs[i] >> 16),
+                100.0 * (double) (pairs[i] >> 16) / (double) total);
+    }
+}
+
+#undef OPSTATS_NUM_PAIRS
+#undef OPSTATS_NUM_OPS
+#endif /* ENABLE_OPSTATS */
+
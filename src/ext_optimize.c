@@ -0,0 +1,350 @@
+// an optional pass over the bytecode of each function, at the end of its
+// compilation, at the level of vm_set_opt_level():
+//   1 folds the arithmetic and the comparisons of number constants, and the
+//     not and the equality of true, false and nil (so a lai `is' or `isnot'
+//     of two literals), jumps over the dead branch of a literal condition,
+//     and threads the jumps that land on jumps
+//   2 also drops the pushes that are popped right away, the POP and GET of
+//     a SET of the same slot, a not not before a condition, and the code
+//     after a return, up to the next jump target
+// nothing moves: a rewrite is written over the instructions it replaces and
+// the bytes it leaves over become NOPS, that run() skips in one dispatch, so
+// no length, jump offset or line changes; no rewrite spans an instruction
+// that a jump lands on, except for the first one
+
+#define OPT_MAX_LEVEL  2
+#define OPT_MAX_PASSES 4
+#define OPT_MAX_HOPS   8
+
+void vm_set_opt_level(DictuVM *vm, int level) {
+    vm->optLevel = level < 0 ? 0 : level > OPT_MAX_LEVEL ? OPT_MAX_LEVEL : level;
+}
+
+#ifndef OPT_DISABLED
+typedef struct {
+    DictuVM *vm;
+    Chunk *chunk;
+    uint8_t *targets;
+    int level;
+    bool changed;
+} Optimizer;
+
+// the next instruction, past the NOPS that follow
+static int optNext(Optimizer *opt, int ip) {
+    Chunk *chunk = opt->chunk;
+    ip += chunk->code[ip] == OP_NOPS ? 1 : 1 + getArgCount(chunk->code, chunk->constants, ip);
+
+    while (ip < chunk->count && chunk->code[ip] == OP_NOPS)
+        ip++;
+
+    return ip;
+}
+
+static bool optIsJump(uint8_t op) {
+    return OPT_FORWARD_JUMP(op) || op == OP_LOOP;
+}
+
+static int optJumpTarget(Optimizer *opt, int ip) {
+    uint8_t *code = opt->chunk->code;
+    int offset = (code[ip + 1] << 8) | code[ip + 2];
+    return code[ip] == OP_LOOP ? ip + 3 - offset : ip + 3 + offset;
+}
+
+static bool optSetJumpTarget(Optimizer *opt, int ip, int target) {
+    uint8_t *code = opt->chunk->code;
+    int offset = code[ip] == OP_LOOP ? ip + 3 - target : target - (ip + 3);
+    if (offset < 0 || offset > UINT16_MAX)
+        return false;
+
+    code[ip + 1] = (offset >> 8) & 0xff;
+    code[ip + 2] = offset & 0xff;
+    opt->targets[target] = 1;
+    opt->changed = true;
+    return true;
+}
+
+// no jump lands after from and before to
+static bool optStraight(Optimizer *opt, int from, int to) {
+    for (int i = from + 1; i < to; i++)
+        if (opt->targets[i])
+            return false;
+
+    return true;
+}
+
+static void optBlank(Optimizer *opt, int from, int to) {
+    memset(opt->chunk->code + from, OP_NOPS, to - from);
+    opt->changed = true;
+}
+
+static bool optConstant(Optimizer *opt, int ip, Value *value) {
+    uint8_t *code = opt->chunk->code;
+
+    switch (code[ip]) {
+        case OP_CONSTANT:
+            *value = opt->chunk->constants.values[code[ip + 1]];
+            return true;
+        case OP_TRUE:
+            *value = BOOL_VAL(true);
+            return true;
+        case OP_FALSE:
+            *value = BOOL_VAL(false);
+            return true;
+        case OP_NIL:
+            *value = NIL_VAL;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool optIsLiteral(Value value) {
+    return IS_BOOL(value) || IS_NIL(value);
+}
+
+// the value, as one instruction at from, with NOPS up to to; numbers reuse
+// an equal constant of the chunk, or add one while there is an index left
+static bool optWriteConstant(Optimizer *opt, int from, int to, Value value) {
+    uint8_t *code = opt->chunk->code;
+
+    if (optIsLiteral(value)) {
+        optBlank(opt, from + 1, to);
+        code[from] = IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+        return true;
+    }
+
+    ValueArray *constants = &opt->chunk->constants;
+    int index = 0;
+    while (index < constants->count && memcmp(&constants->values[index], &value, sizeof(Value)) != 0)
+        index++;
+
+    if (index > UINT8_MAX)
+        return false;
+
+    if (index == constants->count)
+        index = addConstant(opt->vm, opt->chunk, value);
+
+    optBlank(opt, from + 2, to);
+    code[from] = OP_CONSTANT;
+    code[from + 1] = (uint8_t) index;
+    return true;
+}
+
+// a literal condition: a false one jumps straight past the POP that its jump
+// lands on, and a true one is blanked up to the POP that follows, with it
+static bool optCondition(Optimizer *opt, int ip, int jump, bool falsey) {
+    uint8_t *code = opt->chunk->code;
+    int target = optJumpTarget(opt, jump);
+
+    if (falsey) {
+        if (target >= opt->chunk->count || code[target] != OP_POP ||
+            !optStraight(opt, ip, jump + 3) || target + 1 - (ip + 3) > UINT16_MAX)
+            return false;
+
+        optBlank(opt, ip, jump + 3);
+        code[ip] = OP_JUMP;
+        return optSetJumpTarget(opt, ip, target + 1);
+    }
+
+    int pop = optNext(opt, jump);
+    if (pop >= opt->chunk->count || code[pop] != OP_POP || !optStraight(opt, ip, pop + 1))
+        return false;
+
+    optBlank(opt, ip, pop + 1);
+    return true;
+}
+
+static bool optFold(Optimizer *opt, int ip) {
+    uint8_t *code = opt->chunk->code;
+    int count = opt->chunk->count;
+    Value a, b, result;
+
+    if (!optConstant(opt, ip, &a))
+        return false;
+
+    int next = optNext(opt, ip);
+    if (next >= count)
+        return false;
+
+    if (optIsLiteral(a)) {
+        bool falsey = IS_NIL(a) || !AS_BOOL(a);
+
+        if (code[next] == OP_JUMP_IF_FALSE)
+            return optCondition(opt, ip, next, falsey);
+
+        if (code[next] == OP_NOT && optStraight(opt, ip, next + 1))
+            return optWriteConstant(opt, ip, next + 1, BOOL_VAL(falsey));
+    }
+
+    if (IS_NUMBER(a) && code[next] == OP_NEGATE && optStraight(opt, ip, next + 1))
+        return optWriteConstant(opt, ip, next + 1, NUMBER_VAL(-AS_NUMBER(a)));
+
+    if (!optConstant(opt, next, &b))
+        return false;
+
+    int op = optNext(opt, next);
+    if (op >= count || !optStraight(opt, ip, op + 1))
+        return false;
+
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a), y = AS_NUMBER(b);
+
+        switch (code[op]) {
+            case OP_ADD:
+                result = NUMBER_VAL(x + y);
+                break;
+            case OP_SUBTRACT:
+                result = NUMBER_VAL(x - y);
+                break;
+            case OP_MULTIPLY:
+                result = NUMBER_VAL(x * y);
+                break;
+            case OP_DIVIDE:
+                if (y == 0)
+                    return false;
+                result = NUMBER_VAL(x / y);
+                break;
+            case OP_GREATER:
+                result = BOOL_VAL(x > y);
+                break;
+            case OP_LESS:
+                result = BOOL_VAL(x < y);
+                break;
+            case OP_EQUAL:
+                // the vm compares the bits, that differ for 0 and -0 or NaNs
+                if (x == 0 || y == 0 || x != x || y != y)
+                    return false;
+                result = BOOL_VAL(x == y);
+                break;
+            default:
+                return false;
+        }
+    } else if (optIsLiteral(a) && optIsLiteral(b) && code[op] == OP_EQUAL) {
+        result = BOOL_VAL(memcmp(&a, &b, sizeof(Value)) == 0);
+    } else {
+        return false;
+    }
+
+    return optWriteConstant(opt, ip, op + 1, result);
+}
+
+static void optThread(Optimizer *opt, int ip) {
+    uint8_t *code = opt->chunk->code;
+    int count = opt->chunk->count;
+    uint8_t op = code[ip];
+    int target = optJumpTarget(opt, ip), final = target;
+
+    for (int hops = 0; hops < OPT_MAX_HOPS && final < count; hops++) {
+        while (final < count && code[final] == OP_NOPS)
+            final++;
+
+        // a false condition is still false at the next JUMP_IF_FALSE
+        if (final < count && (code[final] == OP_JUMP ||
+            (op == OP_JUMP_IF_FALSE && code[final] == OP_JUMP_IF_FALSE)))
+            final = optJumpTarget(opt, final);
+        else
+            break;
+    }
+
+    if (final == target || final > count)
+        return;
+
+    if (op == OP_LOOP ? final <= ip + 3 : final >= ip + 3)
+        optSetJumpTarget(opt, ip, final);
+}
+
+static bool optPushPop(Optimizer *opt, int ip) {
+    uint8_t *code = opt->chunk->code;
+    int count = opt->chunk->count;
+    uint8_t op = code[ip];
+    int next = optNext(opt, ip);
+    Value value;
+
+    if (next >= count)
+        return false;
+
+    if ((optConstant(opt, ip, &value) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE) &&
+        code[next] == OP_POP && optStraight(opt, ip, next + 1)) {
+        optBlank(opt, ip, next + 1);
+        return true;
+    }
+
+    if ((op == OP_SET_LOCAL || op == OP_SET_UPVALUE) && code[next] == OP_POP) {
+        uint8_t get = op == OP_SET_LOCAL ? OP_GET_LOCAL : OP_GET_UPVALUE;
+        int load = optNext(opt, next);
+
+        if (load < count && code[load] == get && code[load + 1] == code[ip + 1] &&
+            optStraight(opt, ip, load + 2)) {
+            optBlank(opt, next, load + 2);
+            return true;
+        }
+    }
+
+    // only the truth of the value matters, when both ways of the jump pop it
+    if (op == OP_NOT && code[next] == OP_NOT) {
+        int jump = optNext(opt, next);
+
+        if (jump < count && code[jump] == OP_JUMP_IF_FALSE && optStraight(opt, ip, jump) &&
+            optJumpTarget(opt, jump) < count && code[optJumpTarget(opt, jump)] == OP_POP &&
+            optNext(opt, jump) < count && code[optNext(opt, jump)] == OP_POP) {
+            optBlank(opt, ip, next + 1);
+            return true;
+        }
+    }
+
+    if (op == OP_RETURN) {
+        int end = ip + 1;
+        while (end < count && !opt->targets[end])
+            end++;
+
+        if (optNext(opt, ip) < end) {
+            optBlank(opt, ip + 1, end);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void optimizeChunk(DictuVM *vm, Chunk *chunk) {
+    if (vm->optLevel == 0 || chunk->count == 0)
+        return;
+
+    Optimizer opt = {.vm = vm, .chunk = chunk, .level = vm->optLevel};
+    opt.targets = calloc(chunk->count + 1, 1);
+    if (opt.targets == NULL)
+        return;
+
+    for (int ip = 0; ip < chunk->count; ip = optNext(&opt, ip))
+        if (optIsJump(chunk->code[ip])) {
+            int target = optJumpTarget(&opt, ip);
+            if (target >= 0 && target <= chunk->count)
+                opt.targets[target] = 1;
+        }
+
+    for (int pass = 0; pass < OPT_MAX_PASSES; pass++) {
+        opt.changed = false;
+
+        for (int ip = 0; ip < chunk->count; ip = optNext(&opt, ip)) {
+            if (optIsJump(chunk->code[ip]))
+                optThread(&opt, ip);
+            else if (!optFold(&opt, ip) && opt.level >= 2)
+                optPushPop(&opt, ip);
+        }
+
+        if (!opt.changed)
+            break;
+    }
+
+    free(opt.targets);
+}
+#else
+void optimizeChunk(DictuVM *vm, Chunk *chunk) {
+    (void) vm;
+    (void) chunk;
+}
+#endif /* OPT_DISABLED */
+
+#undef OPT_MAX_HOPS
+#undef OPT_MAX_PASSES
+#undef OPT_MAX_LEVEL
@@ -0,0 +1,185 @@
+#ifdef ENABLE_PROFILER
+// a SIGPROF timer sets vm_profile_pending, that VM_SAFEPOINT polls, and the
+// safepoint samples the frames; the samples are folded into "frame;frame;... count" lines, that
+// flamegraph.pl takes as they are. One vm per process can be profiled
+
+typedef struct {
+    char *stack;
+    uint32_t hash;
+    uint64_t count;
+} ProfileEntry;
+
+typedef struct {
+    DictuVM *vm;
+    char *path;
+    ProfileEntry *entries;
+    size_t count;
+    size_t capacity;
+} Profiler;
+
+static Profiler profiler;
+
+// the handler writes the flag only, the vm is left to the safepoint
+volatile sig_atomic_t vm_profile_pending;
+
+static void profilerTick(int sig) {
+    UNUSED(sig);
+    vm_profile_pending = 1;
+}
+
+static uint32_t profilerHash(const char *stack, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) stack[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static ProfileEntry *profilerSlot(ProfileEntry *entries, size_t capacity,
+        const char *stack, uint32_t hash) {
+    size_t slot = hash & (capacity - 1);
+    while (entries[slot].stack != NULL &&
+            (entries[slot].hash != hash || strcmp(entries[slot].stack, stack) != 0))
+        slot = (slot + 1) & (capacity - 1);
+
+    return &entries[slot];
+}
+
+static bool profilerGrow(void) {
+    size_t capacity = profiler.capacity == 0 ? 256 : profiler.capacity * 2;
+    ProfileEntry *entries = calloc(capacity, sizeof(ProfileEntry));
+    if (entries == NULL)
+        return false;
+
+    for (size_t i = 0; i < profiler.capacity; i++) {
+        ProfileEntry *entry = &profiler.entries[i];
+        if (entry->stack != NULL)
+            *profilerSlot(entries, capacity, entry->stack, entry->hash) = *entry;
+    }
+
+    free(profiler.entries);
+    profiler.entries = entries;
+    profiler.capacity = capacity;
+    return true;
+}
+
+// outermost frame first, as "function (module:line)"
+static void profilerSample(DictuVM *vm) {
+    char stack[4096];
+    size_t length = 0;
+
+    for (int i = 0; i < vm->frameCount && length < sizeof(stack) - 1; i++) {
+        CallFrame *frame = &vm->frames[i];
+        ObjFunction *function = frame->closure->function;
+
+        int instruction = (int) (frame->ip - function->chunk.code) - 1;
+        int line = instruction < 0 ? 0 : function->chunk.lines[instruction];
+        const char *module = function->module != NULL ? function->module->name->chars : "?";
+        const char *name = function->name != NULL ? function->name->chars : "<script>";
+
+        int n = snprintf(stack + length, sizeof(stack) - length, "%s%s (%s:%d)",
+                i ? ";" : "", name, module, line);
+        if (n < 0)
+            return;
+
+        length += (size_t) n;
+    }
+
+    if (length == 0)
+        return;
+
+    if (length > sizeof(stack) - 1)
+        length = sizeof(stack) - 1;
+    stack[length] = '\0';
+
+    if ((profiler.count + 1) * 2 > profiler.capacity && !profilerGrow())
+        return;
+
+    uint32_t hash = profilerHash(stack, length);
+    ProfileEntry *entry = profilerSlot(profiler.entries, profiler.capacity, stack, hash);
+    if (entry->stack == NULL) {
+        entry->stack = strdup(stack);
+        if (entry->stack == NULL)
+            return;
+
+        entry->hash = hash;
+        profiler.count++;
+    }
+
+    entry->count++;
+}
+
+bool vm_profiler_write(DictuVM *vm, const char *path) {
+    UNUSED(vm);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+
+    for (size_t i = 0; i < profiler.capacity; i++) {
+        ProfileEntry *entry = &profiler.entries[i];
+        if (entry->stack != NULL)
+            fprintf(fp, "%s %llu\n", entry->stack, (unsigned long long) entry->count);
+    }
+
+    return fclose(fp) == 0;
+}
+
+// hz 0 is 99 samples per second of cpu time; a non NULL path is written by
+// vm_profiler_stop(), and so by dictuFreeVM() and vm_exit()
+bool vm_profiler_start(DictuVM *vm, int hz, const char *path) {
+    if (profiler.vm != NULL)
+        return false;
+
+    if (hz <= 0)
+        hz = 99;
+
+    profiler.path = path != NULL ? strdup(path) : NULL;
+    profiler.vm = vm;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profilerTick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 1 ? 1000000 / hz : 999999;
+    timer.it_value = timer.it_interval;
+
+    if (sigaction(SIGPROF, &sa, NULL) == -1 || setitimer(ITIMER_PROF, &timer, NULL) == -1) {
+        signal(SIGPROF, SIG_DFL);
+        free(profiler.path);
+        profiler.path = NULL;
+        profiler.vm = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void vm_profiler_stop(DictuVM *vm) {
+    if (profiler.vm != vm)
+        return;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_DFL);
+    profiler.vm = NULL;
+
+    if (profiler.path != NULL && !vm_profiler_write(vm, profiler.path))
+        fprintf(stderr, "Could not write the profile to \"%s\".\n", profiler.path);
+
+    for (size_t i = 0; i < profiler.capacity; i++)
+        free(profiler.entries[i].stack);
+
+    free(profiler.entries);
+    free(profiler.path);
+    memset(&profiler, 0, sizeof(profiler));
+}
+
+#endif /* ENABLE_PROFILER */
+
@@ -0,0 +1,125 @@
+/* reset a vm to a snapshot of its globals and modules */
+
+void vm_reset_snapshot(DictuVM *vm) {
+    initTable(&vm->baseGlobals);
+    tableAddAll(vm, &vm->globals, &vm->baseGlobals);
+    initTable(&vm->baseModules);
+    tableAddAll(vm, &vm->modules, &vm->baseModules);
+}
+
+// the current globals and modules become the state that dictuResetVM()
+// returns to, so a warmed up vm can be reused without paying its setup again
+void dictuSnapshotVM(DictuVM *vm) {
+    freeTable(vm, &vm->baseGlobals);
+    freeTable(vm, &vm->baseModules);
+    vm_reset_snapshot(vm);
+}
+
+// only the names that the prelude lists in its __exports__ are published:
+// the compiler resolves a global ahead of a module variable, read only, so
+// every published name is taken from the scripts that follow, as the names
+// of the builtin natives are; names that start with "__" are never published
+static bool preludeExport(DictuVM *vm, ObjModule *module) {
+    Value exports;
+    if (!tableGet(&module->values, copyString(vm, "__exports__", 11), &exports))
+        return true;
+
+    if (!IS_LIST(exports)) {
+        fprintf(stderr, "%s: __exports__ is not a list.\n", module->name->chars);
+        return false;
+    }
+
+    ObjList *list = AS_LIST(exports);
+    for (int i = 0; i < list->values.count; i++) {
+        Value value;
+        Value name = list->values.values[i];
+
+        if (!IS_STRING(name) || AS_STRING(name)->length < 1 ||
+                strncmp(AS_STRING(name)->chars, "__", 2) == 0 ||
+                !tableGet(&module->values, AS_STRING(name), &value)) {
+            fprintf(stderr, "%s: __exports__ entry %d is not a variable of the prelude.\n",
+                    module->name->chars, i);
+            return false;
+        }
+
+        tableSet(vm, &vm->globals, AS_STRING(name), value);
+    }
+
+    return true;
+}
+
+DictuInterpretResult dictuInterpretPrelude(DictuVM *vm, char *moduleName, char *source) {
+    DictuInterpretResult result = dictuInterpret(vm, moduleName, source);
+    if (result != INTERPRET_OK)
+        return result;
+
+    ObjModule *module = vm_module_get(vm, moduleName, strlen(moduleName));
+    if (module != NULL && !preludeExport(vm, module))
+        return INTERPRET_RUNTIME_ERROR;
+
+    dictuSnapshotVM(vm);
+    return INTERPRET_OK;
+}
+
+// user globals, modules and the objects they hold are dropped, but the native
+// method tables and the snapshot (with their interned names) are kept; the
+// snapshot holds references, not copies, so a list, a dict or an instance of
+// the prelude that a script changes, stays changed for the next one
+void dictuResetVM(DictuVM *vm) {
+    resetStack(vm);
+    vm->lastModule = NULL;
+
+    freeTable(vm, &vm->modules);
+    initTable(&vm->modules);
+    tableAddAll(vm, &vm->baseModules, &vm->modules);
+
+    freeTable(vm, &vm->globals);
+    initTable(&vm->globals);
+    tableAddAll(vm, &vm->baseGlobals, &vm->globals);
+
+    collectGarbage(vm);
+    vm->safepoint = 0;
+}
+
+// System.exit() of a script comes here, so a host that serves scripts gets
+// the status before the process goes away
+void vm_exit(DictuVM *vm, int status) {
+#ifdef ENABLE_PROFILER
+    // exit() skips dictuFreeVM(), the profile is written here
+    vm_profiler_stop(vm);
+#endif
+
+    if (vm->exitHook != NULL)
+        vm->exitHook(vm, status);
+
+    exit(status);
+}
+
+void vm_on_exit(DictuVM *vm, void (*hook)(DictuVM *vm, int status)) {
+    vm->exitHook = hook;
+}
+
+// System.argv for the next script that a reused vm runs; as with
+// dictuInitVM(), argv[0] is the program and argv[1] the script
+void dictuSetArgv(DictuVM *vm, int argc, char *argv[]) {
+    Value klass;
+    ObjString *name = copyString(vm, "System", 6);
+    if (!tableGet(&vm->globals, name, &klass) || !IS_NATIVE_CLASS(klass))
+        return;
+
+    push(vm, klass);
+    ObjList *list = newList(vm);
+    push(vm, OBJ_VAL(list));
+
+    for (int i = 1; i < argc; i++) {
+        Value arg = OBJ_VAL(copyString(vm, argv[i], strlen(argv[i])));
+        push(vm, arg);
+        writeValueArray(vm, &list->values, arg);
+        pop(vm);
+    }
+
+    defineNativeProperty(vm, &AS_CLASS_NATIVE(klass)->properties, "argv", OBJ_VAL(list));
+    pop(vm);
+    pop(vm);
+}
+
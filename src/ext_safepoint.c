@@ -0,0 +1,107 @@
+// run() counts down vm->ticks at backward jumps and calls; when it runs out,
+// the safepoint looks at the raised reasons and at the time slice, with the
+// stack at a consistent state
+
+// the countdown stops early; what is left of it goes back to the slice
+static void sliceReturn(DictuVM *vm) {
+    if (vm->sliceTicks != 0 && vm->ticks > 0)
+        vm->sliceLeft += vm->ticks;
+
+    vm->ticks = 0;
+}
+
+void vm_safepoint_raise(DictuVM *vm, int reason) {
+    vm->safepoint |= reason;
+    sliceReturn(vm);
+}
+
+static void sliceNext(DictuVM *vm) {
+    int64_t next = INT64_MAX;
+    if (vm->sliceTicks != 0)
+        next = vm->sliceLeft;
+
+    if (vm->deadline != 0 && next > VM_SLICE_CLOCK_TICKS)
+        next = VM_SLICE_CLOCK_TICKS;
+
+    if (vm->sliceTicks != 0)
+        vm->sliceLeft -= next;
+
+    vm->ticks = next;
+}
+
+void vm_slice_start(DictuVM *vm) {
+    vm->sliceLeft = (int64_t) vm->sliceTicks;
+    vm->deadline = vm->sliceNs != 0 ? vm_clock_ns() + vm->sliceNs : 0;
+    sliceNext(vm);
+
+    // a reason raised before run(), while compiling say, is taken at the
+    // first safepoint
+    if (vm->safepoint != 0)
+        sliceReturn(vm);
+}
+
+DictuInterpretResult vm_safepoint(DictuVM *vm) {
+    int reasons = vm->safepoint;
+    vm->safepoint = 0;
+    sliceReturn(vm);
+
+    // the reason can be stale, raised by the last allocations of a previous
+    // script or while compiling; it ends the script only if the heap is
+    // still over the limit after a collection
+    if ((reasons & VM_SAFEPOINT_HEAP) && vm->heapLimit != 0 &&
+        vm->bytesAllocated > vm->heapLimit) {
+        collectGarbage(vm);
+
+        if (vm->bytesAllocated > vm->heapLimit) {
+            runtimeError(vm, "Heap limit of %zu bytes exceeded", vm->heapLimit);
+            return INTERPRET_MEMORY_ERROR;
+        }
+    }
+
+#ifdef ENABLE_PROFILER
+    // any vm clears it, or the others would stop at every safepoint
+    if (vm_profile_pending) {
+        vm_profile_pending = 0;
+        if (profiler.vm == vm)
+            profilerSample(vm);
+    }
+#endif
+
+    bool expired = (vm->sliceTicks != 0 && vm->sliceLeft <= 0) ||
+                   (vm->deadline != 0 && vm_clock_ns() >= vm->deadline);
+
+    if (expired) {
+        if (vm->runDepth == 1)
+            return INTERPRET_YIELD;
+
+        // a native is calling back into a script; that run() can't yield,
+        // so the outer one does at its next safepoint
+        vm->ticks = 1;
+        return INTERPRET_OK;
+    }
+
+    sliceNext(vm);
+    return INTERPRET_OK;
+}
+
+// the next collection is due at the limit at the latest, so the check stays
+// out of the allocation fast path: reallocate() looks at the limit only
+// after it has collected
+void vm_heap_limit(DictuVM *vm, size_t bytes) {
+    vm->heapLimit = bytes;
+    vm_gc_next(vm);
+}
+
+void vm_time_slice(DictuVM *vm, uint64_t ticks, uint64_t ns) {
+    vm->sliceTicks = ticks;
+    vm->sliceNs = ns;
+    vm_slice_start(vm);
+}
+
+DictuInterpretResult dictuResume(DictuVM *vm) {
+    if (vm->frameCount == 0)
+        return INTERPRET_OK;
+
+    return run(vm);
+}
+
@@ -0,0 +1,47 @@
+// System.gcStats(), the vm_gc_stats() counters as a dict
+Value vm_gc_stats_native(DictuVM *vm, int argCount, Value *args) {
+    UNUSED(args);
+    if (argCount != 0) {
+        runtimeError(vm, "gcStats() takes no arguments (%d given)", argCount);
+        return EMPTY_VAL;
+    }
+
+    DictuGCStats stats;
+    vm_gc_stats(vm, &stats);
+
+    const char *names[] = {"bytesAllocated", "bytesFreed", "liveBytes",
+        "collections", "totalPauseNs", "maxPauseNs"};
+    uint64_t values[] = {stats.bytesAllocated, stats.bytesFreed, stats.liveBytes,
+        stats.collections, stats.totalPauseNs, stats.maxPauseNs};
+
+    ObjDict *dict = initDict(vm);
+    push(vm, OBJ_VAL(dict));
+
+    for (int i = 0; i < 6; i++) {
+        Value key = OBJ_VAL(copyString(vm, names[i], strlen(names[i])));
+        push(vm, key);
+        dictSet(vm, dict, key, NUMBER_VAL((double) values[i]));
+        pop(vm);
+    }
+
+    ObjDict *objects = initDict(vm);
+    push(vm, OBJ_VAL(objects));
+
+    for (int i = 0; vm_gc_obj_type_name(i) != NULL; i++) {
+        const char *name = vm_gc_obj_type_name(i);
+        Value key = OBJ_VAL(copyString(vm, name, strlen(name)));
+        push(vm, key);
+        dictSet(vm, objects, key, NUMBER_VAL((double) stats.objects[i]));
+        pop(vm);
+    }
+
+    Value key = OBJ_VAL(copyString(vm, "objects", 7));
+    push(vm, key);
+    dictSet(vm, dict, key, OBJ_VAL(objects));
+    pop(vm);
+    pop(vm);
+
+    pop(vm);
+    return OBJ_VAL(dict);
+}
+
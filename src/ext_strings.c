@@ -0,0 +1,58 @@
+/* strings that are not copied into the vm heap */
+
+void vm_string_release_none(void *data, char *chars, int length) {
+    UNUSED(data); UNUSED(chars); UNUSED(length);
+}
+
+static ObjString *externalString(DictuVM *vm, const char *chars, int length,
+        uint32_t hash, ObjStringRelease release, void *releaseData) {
+    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        release(releaseData, (char *) chars, length);
+        return interned;
+    }
+
+    ObjString *string = allocateString(vm, (char *) chars, length, hash);
+    string->release = release;
+    string->releaseData = releaseData;
+    if (release != vm_string_release_none)
+        vm->finalizers++;
+    return string;
+}
+
+ObjString *vm_string_external(DictuVM *vm, const char *chars, int length,
+        ObjStringRelease release, void *releaseData) {
+    if (NULL == release)
+        release = vm_string_release_none;
+
+    return externalString(vm, chars, length, hashString(chars, length),
+            release, releaseData);
+}
+
+// lmake rewrites the defineNative() calls of the datatypes and optionals to
+// this, with the length and the hash of the (static) name computed at
+// generation time
+void defineNativeHashed(DictuVM *vm, Table *table, const char *name,
+        int length, uint32_t hash, NativeFn function) {
+    ObjNative *native = newNative(vm, function);
+    push(vm, OBJ_VAL(native));
+    ObjString *methodName = externalString(vm, name, length, hash,
+            vm_string_release_none, NULL);
+    push(vm, OBJ_VAL(methodName));
+    tableSet(vm, table, methodName, OBJ_VAL(native));
+    pop(vm);
+    pop(vm);
+}
+
+// grows a table once, to hold count entries without rehashing
+void vm_table_reserve(DictuVM *vm, Table *table, int count) {
+    int capacity = table->capacityMask + 1;
+    if (count <= capacity * TABLE_MAX_LOAD)
+        return;
+
+    while (count > capacity * TABLE_MAX_LOAD)
+        capacity = capacity < 8 ? 8 : capacity * 2;
+
+    adjustCapacity(vm, table, capacity - 1);
+}
+
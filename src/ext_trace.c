@@ -0,0 +1,177 @@
+// Chrome trace events (chrome://tracing, ui.perfetto.dev), of interpret,
+// compile, import, collections and of slow native calls; the events of all
+// the vms of the process go to one file, by thread. Off, a trace point is
+// a test of vm_trace_file. An event is a single write() to the file, opened
+// with O_APPEND and without stdio buffering, so forked serve workers add
+// their events (under their own pid) and have nothing of the parent to write
+
+FILE *vm_trace_file = NULL;
+static uint64_t traceNativeNs;
+static uint64_t traceEpoch;
+static pid_t tracePid;
+static int traceThreads;
+static _Thread_local int traceTid;
+
+typedef struct {
+    char chars[4096];
+    size_t length;
+} TraceLine;
+
+static void traceWrite(TraceLine *line) {
+    int fd = fileno(vm_trace_file);
+    const char *chars = line->chars;
+    size_t length = line->length;
+
+    while (length > 0) {
+        ssize_t written = write(fd, chars, length);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+
+        chars += written;
+        length -= (size_t) written;
+    }
+}
+
+static void traceAppend(TraceLine *line, const char *format, ...) {
+    size_t left = sizeof(line->chars) - line->length;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line->chars + line->length, left, format, args);
+    va_end(args);
+
+    if (length > 0)
+        line->length += (size_t) length < left ? (size_t) length : left - 1;
+}
+
+bool vm_trace_start(const char *path, uint64_t nativeThresholdNs) {
+    if (vm_trace_file != NULL)
+        return false;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd == -1)
+        return false;
+
+    FILE *fp = fdopen(fd, "a");
+    if (fp == NULL) {
+        close(fd);
+        return false;
+    }
+
+    traceNativeNs = nativeThresholdNs;
+    traceEpoch = vm_clock_ns();
+    tracePid = getpid();
+    vm_trace_file = fp;
+
+    TraceLine line = {.length = 0};
+    traceAppend(&line, "[\n");
+    traceWrite(&line);
+    return true;
+}
+
+// only the process that started the trace closes the array
+void vm_trace_stop(void) {
+    if (vm_trace_file == NULL)
+        return;
+
+    if (getpid() == tracePid) {
+        TraceLine line = {.length = 0};
+        traceAppend(&line, "{}]\n");
+        traceWrite(&line);
+    }
+
+    FILE *fp = vm_trace_file;
+    vm_trace_file = NULL;
+    fclose(fp);
+}
+
+// DICTU_TRACE=path [DICTU_TRACE_NATIVE_US=us], read when a vm is created
+void vm_trace_env(void) {
+    const char *path = getenv("DICTU_TRACE");
+    if (path == NULL || *path == '\0' || vm_trace_file != NULL)
+        return;
+
+    const char *us = getenv("DICTU_TRACE_NATIVE_US");
+    uint64_t threshold = us != NULL ? strtoull(us, NULL, 10) * 1000 : 100000;
+
+    if (vm_trace_start(path, threshold))
+        atexit(vm_trace_stop);
+}
+
+// long strings are cut, leaving room for the rest of the event
+static void traceString(TraceLine *line, const char *s) {
+    traceAppend(line, "\"");
+    for (; *s && line->length < sizeof(line->chars) - 512; s++) {
+        if (*s == '"' || *s == '\\')
+            traceAppend(line, "\\%c", *s);
+        else if ((unsigned char) *s < ' ')
+            traceAppend(line, "\\u%04x", *s);
+        else
+            traceAppend(line, "%c", *s);
+    }
+    traceAppend(line, "\"");
+}
+
+// a complete ("X") event, or an instant ("i") one when end is 0
+void vm_trace_event(const char *name, const char *cat, uint64_t start, uint64_t end,
+        const char *arg) {
+    FILE *fp = vm_trace_file;
+    if (fp == NULL)
+        return;
+
+    if (traceTid == 0) {
+        flockfile(fp);
+        traceTid = ++traceThreads;
+        funlockfile(fp);
+    }
+
+    TraceLine line = {.length = 0};
+    traceAppend(&line, "{\"name\":");
+    traceString(&line, name);
+    traceAppend(&line, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,", cat, end ? "X" : "i",
+            (double) (start - traceEpoch) / 1000.0);
+
+    if (end)
+        traceAppend(&line, "\"dur\":%.3f,", (double) (end - start) / 1000.0);
+    else
+        traceAppend(&line, "\"s\":\"t\",");
+
+    traceAppend(&line, "\"pid\":%d,\"tid\":%d", (int) getpid(), traceTid);
+
+    if (arg != NULL) {
+        traceAppend(&line, ",\"args\":{\"name\":");
+        traceString(&line, arg);
+        traceAppend(&line, "}");
+    }
+
+    traceAppend(&line, "},\n");
+    traceWrite(&line);
+}
+
+ObjFunction *vm_trace_compile(DictuVM *vm, ObjModule *module, char *source) {
+    if (vm_trace_file == NULL)
+        return compile(vm, module, source);
+
+    uint64_t start = vm_clock_ns();
+    ObjFunction *function = compile(vm, module, source);
+    vm_trace_event("compile", "compile", start, vm_clock_ns(), module->name->chars);
+    return function;
+}
+
+// natives have no name at hand, the event names the function address
+Value vm_trace_native(NativeFn native, DictuVM *vm, int argCount, Value *args) {
+    uint64_t start = vm_clock_ns();
+    Value result = native(vm, argCount, args);
+    uint64_t end = vm_clock_ns();
+
+    if (end - start >= traceNativeNs) {
+        char name[32];
+        snprintf(name, sizeof(name), "native %p", (void *) (uintptr_t) native);
+        vm_trace_event(name, "native", start, end, NULL);
+    }
+
+    return result;
+}
+
@@ -130,24 +130,644 @@ static char *readfile(const char *path) {
     return buffer;
 }
 
+// a script read from a pipe, the "-" path
+static char *readstream(FILE *file) {
+    size_t size = 4096, length = 0;
+    char *buffer = malloc(size);
+
+    while (buffer != NULL) {
+        length += fread(buffer + length, sizeof(char), size - length - 1, file);
+        if (length + 1 < size) {
+            break;
+        }
+
+        char *temp = realloc(buffer, size * 2);
+        if (temp == NULL) {
+            free(buffer);
+            buffer = NULL;
+            break;
+        }
+
+        buffer = temp;
+        size *= 2;
+    }
+
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory to read the standard input.\n");
+        exit(74);
+    }
+
+    buffer[length] = '\0';
+    return buffer;
+}
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct {
+    char *source;
+    size_t mapped; // the length of the mapping, 0 when source is malloc'ed
+} Script;
+
+// the mapping is private and writable, as the lai scanner rewrites the source
+// in place; the zero fill of the last page past the end of file terminates
+// the source, so a file that ends on a page boundary is read instead
+static bool mapfile(const char *path, Script *script) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+            st.st_size % sysconf(_SC_PAGESIZE) == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    script->source = addr;
+    script->mapped = st.st_size;
+    return true;
+}
+
+static void releaseScript(Script *script) {
+    if (script->mapped) {
+        munmap(script->source, script->mapped);
+    } else {
+        free(script->source);
+    }
+
+    script->source = NULL;
+}
+
+static bool loadScript(const char *path, Script *script) {
+    script->mapped = 0;
+
+    if (strcmp(path, "-") == 0) {
+        script->source = readstream(stdin);
+        return true;
+    }
+
+    if (mapfile(path, script)) {
+        return true;
+    }
+
+    script->source = readfile(path);
+    return script->source != NULL;
+}
+
+// returns the exit status of the interpreter
+static int runScript(DictuVM *vm, const char *path) {
+    Script script;
+
+    if (!loadScript(path, &script)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return 74;
+    }
+
+    DictuInterpretResult result = dictuInterpret(vm, (char *) path, script.source);
+    releaseScript(&script); // [owner]
+
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    if (result == INTERPRET_MEMORY_ERROR) return 71;
+    return 0;
+}
+
 static void runFile(DictuVM *vm, int argc, const char *argv[]) {
     UNUSED(argc);
-    char *source = readfile(argv[1]);
 
-    if (source == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", argv[1]);
+    int status = runScript(vm, argv[1]);
+    if (status != 0) {
+#ifdef ENABLE_PROFILER
+        // the profile of a failing script is still written
+        vm_profiler_stop(vm);
+#endif
+        exit(status);
+    }
+}
+
+static void runPrelude(DictuVM *vm, const char *path) {
+    Script script;
+
+    if (!loadScript(path, &script)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
 
-    DictuInterpretResult result = dictuInterpret(vm, (char *) argv[1], source);
-    free(source); // [owner]
+    DictuInterpretResult result = dictuInterpretPrelude(vm, (char *) path, script.source);
+    releaseScript(&script);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_MEMORY_ERROR) exit(71);
+}
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define SERVE_MAX_REQUEST 65536
+#define SERVE_MAX_ARGS    256
+#define SERVE_MAX_WORKERS 64
+
+// a request is a single packet: the working directory of the client, the
+// script path and its arguments, all nul terminated, with the stdin, stdout
+// and stderr of the client passed along, so the script writes straight to
+// them; the reply is the exit status as an int
+
+typedef struct {
+    const char *prelude;
+    const char *serve;
+    const char *client;
+    int workers;
+    bool fork;
+    size_t gcDefer;
+    size_t heapLimit;
+    int optLevel;
+    const char *profile;
+} Options;
+
+typedef union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+} FdMessage;
+
+static int unixSocket(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", path);
+        return -1;
+    }
+
+    strcpy(addr->sun_path, path);
+    return socket(AF_UNIX, SOCK_SEQPACKET, 0);
+}
+
+static int runClient(const char *path, int argc, const char *argv[]) {
+    if (argc > SERVE_MAX_ARGS) {
+        fprintf(stderr, "A script takes at most %d arguments.\n", SERVE_MAX_ARGS - 2);
+        return 1;
+    }
+
+    char request[SERVE_MAX_REQUEST];
+    if (getcwd(request, sizeof(request)) == NULL) {
+        fprintf(stderr, "Could not get the working directory.\n");
+        return 74;
+    }
+
+    size_t length = strlen(request) + 1;
+    for (int i = 1; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        if (length + len > sizeof(request)) {
+            fprintf(stderr, "Arguments are too long.\n");
+            return 1;
+        }
+
+        memcpy(request + length, argv[i], len);
+        length += len;
+    }
+
+    struct sockaddr_un addr;
+    int fd = unixSocket(path, &addr);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Could not connect to \"%s\".\n", path);
+        return 74;
+    }
+
+    FdMessage control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {.iov_base = request, .iov_len = length};
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int stdfds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    memcpy(CMSG_DATA(cmsg), stdfds, sizeof(stdfds));
+
+    if (sendmsg(fd, &msg, 0) == -1) {
+        fprintf(stderr, "Could not send the request to \"%s\".\n", path);
+        close(fd);
+        return 74;
+    }
+
+    // the worker went away without a reply, as when it crashed
+    int status;
+    if (recv(fd, &status, sizeof(status), 0) != sizeof(status)) {
+        status = 70;
+    }
+
+    close(fd);
+    return status;
+}
+
+// the descriptors that came with a request that is dropped
+static void closeRights(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            close(fd);
+        }
+    }
+}
+
+// returns the number of arguments, that are in request with args[0] set to
+// the name of the program, or -1
+static int receiveRequest(int conn, char *request, const char **args,
+        const char **cwd, int fds[3]) {
+    FdMessage control;
+    struct iovec iov = {.iov_base = request, .iov_len = SERVE_MAX_REQUEST};
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    ssize_t length = recvmsg(conn, &msg, 0);
+    if (length <= 0) {
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || request[length - 1] != '\0' ||
+            cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        closeRights(&msg);
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    *cwd = request;
+    int argc = 1;
+    for (ssize_t i = strlen(request) + 1; i < length; i += strlen(request + i) + 1) {
+        if (argc == SERVE_MAX_ARGS) {
+            int status = 1;
+            dprintf(fds[2], "A script takes at most %d arguments.\n", SERVE_MAX_ARGS - 2);
+            for (int j = 0; j < 3; j++) close(fds[j]);
+            send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+            return -1;
+        }
+
+        args[argc++] = request + i;
+    }
+
+    return argc;
+}
+
+// the connection of the request that runs, for the status of a script
+// that calls System.exit(); the process goes away after it
+static int serveConn = -1;
+
+static void serveExit(DictuVM *vm, int status) {
+    UNUSED(vm);
+    fflush(stdout);
+    fflush(stderr);
+
+    if (serveConn != -1) {
+        send(serveConn, &status, sizeof(status), MSG_NOSIGNAL);
+    }
+}
+
+// the script runs with the descriptors of the client in place of the
+// standard ones; afterwards the vm returns to its snapshot, so every
+// request starts from the same warm state
+static void serveRequest(DictuVM *vm, int conn, const int saved[3]) {
+    char request[SERVE_MAX_REQUEST];
+    const char *args[SERVE_MAX_ARGS];
+    const char *cwd;
+    int fds[3];
+
+    args[0] = "dictu";
+    int argc = receiveRequest(conn, request, args, &cwd, fds);
+    if (argc == -1) {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    int status;
+    if (argc < 2) {
+        fprintf(stderr, "Usage: dictu --client=path.sock path [args]\n");
+        status = 1;
+    } else if (chdir(cwd) == -1) {
+        fprintf(stderr, "Could not change directory to \"%s\".\n", cwd);
+        status = 74;
+    } else {
+        dictuSetArgv(vm, argc, (char **) args);
+        serveConn = conn;
+        status = runScript(vm, args[1]);
+        serveConn = -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdin);
+
+    for (int i = 0; i < 3; i++) {
+        dup2(saved[i], i);
+    }
+
+    send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+static void serveStreams(int saved[3]) {
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    // stdin is unbuffered, so no input of one client is left for the next
+    setvbuf(stdin, NULL, _IONBF, 0);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (int i = 0; i < 3; i++) {
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    }
+}
+
+static int serveAccept(int listener) {
+    for (;;) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn != -1) return conn;
+        if (errno != EINTR && errno != ECONNABORTED) return -1;
+    }
+}
+
+static void serveWorker(DictuVM *vm, int listener) {
+    int saved[3];
+    serveStreams(saved);
+
+    for (;;) {
+        int conn = serveAccept(listener);
+        if (conn == -1) exit(74);
+
+        serveRequest(vm, conn, saved);
+        close(conn);
+        dictuResetVM(vm);
+    }
+}
+
+static volatile sig_atomic_t serveStop = 0;
+
+static void serveSignal(int sig) {
+    UNUSED(sig);
+    serveStop = 1;
+}
+
+// every request gets a child of the warm vm, that shares its pages copy on
+// write and exits after the script; the vm of the parent is never touched
+static void serveForked(DictuVM *vm, int listener, size_t gcDefer) {
+    signal(SIGCHLD, SIG_IGN);
+
+    while (!serveStop) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        // nothing the parent buffered is written again by the child
+        fflush(NULL);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            int saved[3];
+            serveStreams(saved);
+            close(listener);
+
+            if (gcDefer > 0) vm_gc_defer(vm, gcDefer);
+            serveRequest(vm, conn, saved);
+            _exit(0);
+        }
+
+        close(conn);
+    }
+}
+
+// only a socket, that an earlier server left behind, is removed
+static void unlinkSocket(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+}
+
+// the workers are forked from the warm vm, so they share its pages; a pool
+// of processes rather than of threads, since a script owns the standard
+// streams and the process while it runs; a worker that exits is replaced
+static int serve(DictuVM *vm, const Options *options) {
+    const char *path = options->serve;
+    int workers = options->workers;
+    struct sockaddr_un addr;
+    int listener = unixSocket(path, &addr);
+    if (listener == -1) {
+        return 74;
+    }
+
+    unlinkSocket(path);
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            listen(listener, SOMAXCONN) == -1) {
+        fprintf(stderr, "Could not listen on \"%s\": %s\n", path, strerror(errno));
+        return 74;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serveSignal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    vm_on_exit(vm, serveExit);
+
+    if (options->fork) {
+        serveForked(vm, listener, options->gcDefer);
+        close(listener);
+        unlinkSocket(path);
+        return 0;
+    }
+
+    pid_t pids[SERVE_MAX_WORKERS] = {0};
+
+    while (!serveStop) {
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] > 0) continue;
+
+            fflush(NULL);
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                serveWorker(vm, listener);
+            }
+        }
+
+        pid_t pid = wait(NULL);
+        if (pid == -1 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] == pid) pids[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+
+    while (wait(NULL) > 0 || errno == EINTR);
+
+    close(listener);
+    unlinkSocket(path);
+    return 0;
+}
+
+#define USAGE "Usage: dictu [-O0|-O1|-O2] [--prelude=path] [--heap-limit=mb] [--profile=path]\n" \
+              "             [--client=path.sock] [path] [args]\n" \
+              "       dictu [-O0|-O1|-O2] [--prelude=path] [--heap-limit=mb] --serve=path.sock\n" \
+              "             [--workers=n | --fork [--gc-defer=mb]]\n"
+
+// a whole decimal number from min to max, or the usage and exit(1)
+static unsigned long long parseNumber(const char *option, const char *value,
+        unsigned long long min, unsigned long long max) {
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(value, &end, 10);
+
+    if (*value < '0' || *value > '9' || *end != '\0' || errno == ERANGE ||
+            number < min || number > max) {
+        fprintf(stderr, "%s takes a number from %llu to %llu\n", option, min, max);
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+
+    return number;
+}
+
+// options precede the script path; they are removed from argv, so the
+// script still sees itself as argv[1]
+static int parseOptions(Options *options, int argc, const char *argv[]) {
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strncmp(argv[i], "--prelude=", 10) == 0) {
+            options->prelude = argv[i] + 10;
+            continue;
+        }
+
+        if (strncmp(argv[i], "--serve=", 8) == 0) {
+            options->serve = argv[i] + 8;
+            continue;
+        }
+
+        if (strncmp(argv[i], "--client=", 9) == 0) {
+            options->client = argv[i] + 9;
+            continue;
+        }
+
+        if (strncmp(argv[i], "--workers=", 10) == 0) {
+            options->workers = (int) parseNumber("--workers=", argv[i] + 10, 1, SERVE_MAX_WORKERS);
+            continue;
+        }
+
+        if (strncmp(argv[i], "-O", 2) == 0) {
+            options->optLevel = argv[i][2] == '\0' ? 1 : (int) parseNumber("-O", argv[i] + 2, 0, 2);
+            continue;
+        }
+
+        if (strncmp(argv[i], "--heap-limit=", 13) == 0) {
+            options->heapLimit = (size_t) parseNumber("--heap-limit=", argv[i] + 13, 0, SIZE_MAX >> 20) << 20;
+            continue;
+        }
+
+#ifdef ENABLE_PROFILER
+        if (strncmp(argv[i], "--profile=", 10) == 0) {
+            options->profile = argv[i] + 10;
+            continue;
+        }
+#endif
+
+        if (strcmp(argv[i], "--fork") == 0) {
+            options->fork = true;
+            continue;
+        }
+
+        if (strncmp(argv[i], "--gc-defer=", 11) == 0) {
+            options->gcDefer = (size_t) parseNumber("--gc-defer=", argv[i] + 11, 0, SIZE_MAX >> 20) << 20;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+
+        if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            fprintf(stderr, USAGE);
+            exit(1);
+        }
+
+        break;
+    }
+
+    int skip = i - 1;
+    for (int j = 1; j + skip < argc; j++)
+        argv[j] = argv[j + skip];
+
+    return argc - skip;
 }
 
 int main(int argc, const char *argv[]) {
-    DictuVM *vm = dictuInitVM(argc == 1, argc, (char **) argv);
+    Options options = {.workers = 4, .gcDefer = (size_t) 64 << 20};
+    argc = parseOptions(&options, argc, argv);
+
+    if (options.client != NULL) {
+        if (argc < 2) {
+            fprintf(stderr, USAGE);
+            return 1;
+        }
+
+        return runClient(options.client, argc, argv);
+    }
+
+    DictuVM *vm = dictuInitVM(argc == 1 && options.serve == NULL, argc, (char **) argv);
+    vm_set_opt_level(vm, options.optLevel);
+
+    if (options.prelude != NULL)
+        runPrelude(vm, options.prelude);
+
+    if (options.heapLimit != 0)
+        vm_heap_limit(vm, options.heapLimit);
+
+    if (options.serve != NULL) {
+        int status = serve(vm, &options);
+        dictuFreeVM(vm);
+        return status;
+    }
 
     if (argc == 1) {
 #ifdef ENABLE_REPL
@@ -156,9 +776,15 @@ int main(int argc, const char *argv[]) {
         return 1;
 #endif
     } else if (argc >= 2) {
+#ifdef ENABLE_PROFILER
+        if (options.profile != NULL && !vm_profiler_start(vm, 0, options.profile)) {
+            fprintf(stderr, "Could not start the profiler.\n");
+            exit(1);
+        }
+#endif
         runFile(vm, argc, argv);
     } else {
-        fprintf(stderr, "Usage: dictu [path] [args]\n");
+        fprintf(stderr, USAGE);
         exit(1);
     }
 
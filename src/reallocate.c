@@ -0,0 +1,42 @@
+void *reallocate(DictuVM *vm, void *previous, size_t oldSize, size_t newSize) {
+    vm->bytesAllocated += newSize - oldSize;
+
+    if (newSize > oldSize) {
+        vm->gcBytesAllocated += newSize - oldSize;
+
+#ifdef DEBUG_STRESS_GC
+        collectGarbage(vm);
+#endif
+
+        if (vm->bytesAllocated > vm->nextGC) {
+            collectGarbage(vm);
+
+            if (vm->heapLimit != 0 && vm->bytesAllocated > vm->heapLimit)
+                vm_safepoint_raise(vm, VM_SAFEPOINT_HEAP);
+        }
+    } else {
+        vm->gcBytesFreed += oldSize - newSize;
+    }
+
+    // a NULL allocator (the default) is libc
+    if (newSize == 0) {
+        if (vm->allocator.free == NULL)
+            free(previous);
+        else
+            vm->allocator.free(vm->allocator.data, previous, oldSize);
+        return NULL;
+    }
+
+    void *ptr;
+    if (vm->allocator.realloc == NULL)
+        ptr = realloc(previous, newSize);
+    else
+        ptr = vm->allocator.realloc(vm->allocator.data, previous, oldSize, newSize);
+
+    if (ptr == NULL) {
+        printf("Unable to allocate memory\n");
+        exit(71);
+    }
+
+    return ptr;
+}
@@ -0,0 +1,22 @@
+    DictuAllocator allocator;
+    Table baseGlobals;
+    Table baseModules;
+    MarkSet marks;
+    double gcGrowFactor;
+    size_t gcMinHeap;
+    DictuGCPauses gcPauses;
+    uint64_t gcBytesAllocated;
+    uint64_t gcBytesFreed;
+    uint64_t gcObjects[VM_GC_OBJ_TYPES];
+    size_t finalizers;
+    size_t heapLimit;
+    int safepoint;
+    int64_t ticks;
+    int64_t sliceLeft;
+    uint64_t sliceTicks;
+    uint64_t sliceNs;
+    uint64_t deadline;
+    int runDepth;
+    int optLevel;
+    uint32_t lazyDeclared;
+    void (*exitHook)(DictuVM *vm, int status);
@@ -0,0 +1,74 @@
+
+/* lmake extensions, that are called from the upstream sources */
+void vm_allocator_setup(DictuVM *vm, DictuAllocator *allocator);
+bool vm_allocator_discard(DictuVM *vm);
+void vm_string_release_none(void *data, char *chars, int length);
+
+/* objects that hold resources outside of the heap: abstracts, and strings
+ * with a release other than the one of the static native names */
+#define VM_OBJ_FINALIZED(object)                                           \
+    ((object)->type == OBJ_ABSTRACT ||                                     \
+     ((object)->type == OBJ_STRING &&                                      \
+      ((ObjString *) (object))->release != NULL &&                         \
+      ((ObjString *) (object))->release != vm_string_release_none))
+void vm_gc_setup(DictuVM *vm);
+void vm_gc_next(DictuVM *vm);
+uint64_t vm_clock_ns(void);
+void vm_gc_pause(DictuVM *vm, uint64_t start, uint64_t sweepStart);
+Value vm_gc_stats_native(DictuVM *vm, int argCount, Value *args);
+DictuInterpretResult vm_safepoint(DictuVM *vm);
+void vm_safepoint_raise(DictuVM *vm, int reason);
+void vm_slice_start(DictuVM *vm);
+void vm_reset_snapshot(DictuVM *vm);
+void vm_exit(DictuVM *vm, int status);
+Table *vm_lazy_methods(DictuVM *vm, Table *table);
+bool vm_mark_test(DictuVM *vm, Obj *object);
+void vm_mark_set(DictuVM *vm, Obj *object);
+void vm_mark_clear(DictuVM *vm);
+
+#define vm_read_file(vm, path)                                             \
+    (vm_trace_file != NULL                                                 \
+        ? vm_trace_event("import", "import", vm_clock_ns(), 0, path)       \
+        : (void) 0,                                                        \
+     readFile(vm, path))
+
+extern FILE *vm_trace_file;
+void vm_trace_env(void);
+void vm_trace_event(const char *name, const char *cat, uint64_t start, uint64_t end,
+        const char *arg);
+ObjFunction *vm_trace_compile(DictuVM *vm, ObjModule *module, char *source);
+Value vm_trace_native(NativeFn native, DictuVM *vm, int argCount, Value *args);
+
+#define vm_call_native(native, vm, argCount, args)                         \
+    (vm_trace_file == NULL                                                 \
+        ? (native)(vm, argCount, args)                                     \
+        : vm_trace_native(native, vm, argCount, args))
+
+/* lmake places it before the DISPATCH() of LOOP and of the call opcodes
+ * (CALL, INVOKE, INVOKE_SUPER, SUPER); the countdown (and the profiler
+ * flag) is the only cost, the reasons are looked at when it runs out */
+#ifdef ENABLE_PROFILER
+extern volatile sig_atomic_t vm_profile_pending;
+#define VM_SAFEPOINT_DUE() (--vm->ticks <= 0 || vm_profile_pending)
+#else
+#define VM_SAFEPOINT_DUE() (--vm->ticks <= 0)
+#endif
+
+#define VM_SAFEPOINT()                                                     \
+    do {                                                                   \
+        if (VM_SAFEPOINT_DUE()) {                                          \
+            STORE_FRAME;                                                   \
+            DictuInterpretResult safepointResult = vm_safepoint(vm);       \
+            if (safepointResult != INTERPRET_OK)                           \
+                return safepointResult;                                    \
+        }                                                                  \
+    } while (0)
+
+/* lmake routes the opcode reads of run() through it */
+#ifdef ENABLE_OPSTATS
+uint8_t vm_opstat(uint8_t op);
+void vm_opstats_dump(FILE *fp);
+#define VM_OPSTAT(op) vm_opstat(op)
+#else
+#define VM_OPSTAT(op) (op)
+#endif
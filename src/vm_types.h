@@ -0,0 +1,53 @@
+/* types of the fields that lmake appends to struct _vm */
+
+typedef struct {
+    void *(*realloc)(void *data, void *ptr, size_t oldSize, size_t newSize);
+    void (*free)(void *data, void *ptr, size_t oldSize);
+    void (*release)(void *data);
+    void *data;
+    bool discardHeap;
+} DictuAllocator;
+
+
+/* the mark bitmap of a 4 KiB page, one bit per 8 bytes */
+#define VM_MARK_PAGE_SHIFT 12
+#define VM_MARK_PAGE_WORDS ((1 << VM_MARK_PAGE_SHIFT) / 8 / 64)
+
+typedef struct {
+    uintptr_t page;
+    uint64_t bits[VM_MARK_PAGE_WORDS];
+} MarkPage;
+
+typedef struct {
+    MarkPage *pages;
+    size_t count;
+    size_t capacity;
+    bool marked;
+} MarkSet;
+
+#define VM_GC_PAUSE_BUCKETS 24
+
+typedef struct {
+    uint64_t collections;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[VM_GC_PAUSE_BUCKETS];
+} DictuGCPauses;
+
+#define VM_GC_OBJ_TYPES 32
+
+typedef struct {
+    uint64_t bytesAllocated;
+    uint64_t bytesFreed;
+    uint64_t liveBytes;
+    uint64_t collections;
+    uint64_t totalPauseNs;
+    uint64_t maxPauseNs;
+    uint64_t objects[VM_GC_OBJ_TYPES];
+} DictuGCStats;
+
+/* the reasons run() stops at its next safepoint, a backward jump or a call */
+#define VM_SAFEPOINT_HEAP    1
+
+/* with a time slice, the clock is read every that many safepoints */
+#define VM_SLICE_CLOCK_TICKS 1024